@@ -0,0 +1,44 @@
+// Shared by the particle shaders. Particles live in structure-of-arrays storage buffers
+// indexed by particle, the alive and dead lists hold particle indices. Emission consumes
+// indices from the dead list and appends them to the alive list, the simulation appends
+// every particle either to the other alive list or back to the dead list, so the two alive
+// lists swap roles every frame.
+
+#ifndef PARTICLE_ACCESS
+#define PARTICLE_ACCESS
+#endif
+
+#define PARTICLE_GROUP_SIZE 256
+
+layout(push_constant) uniform ParticleParams {
+    mat4 viewProjection;
+    vec3 emitterPosition;
+    float deltaTime;
+    uint emitCount;
+    uint parity;        // alive list read this frame, 1 - parity is written
+    uint maxParticles;
+    uint seed;
+} params;
+
+// xyz position, w age in seconds
+layout(std430, set = 0, binding = 0) PARTICLE_ACCESS buffer Positions { vec4 positions[]; };
+// xyz velocity, w lifetime in seconds
+layout(std430, set = 0, binding = 1) PARTICLE_ACCESS buffer Velocities { vec4 velocities[]; };
+// two lists of maxParticles indices each
+layout(std430, set = 0, binding = 2) PARTICLE_ACCESS buffer AliveLists { uint alive[]; };
+layout(std430, set = 0, binding = 3) PARTICLE_ACCESS buffer DeadList { uint dead[]; };
+// The counters, followed by the indirect draw and dispatch commands, matches ParticleState.
+layout(std430, set = 0, binding = 4) PARTICLE_ACCESS buffer State {
+    uint aliveCount[2];
+    int deadCount;
+    uint frame;
+    uint vertexCount;
+    uint instanceCount;
+    uint firstVertex;
+    uint firstInstance;
+    uint groupCountX;
+    uint groupCountY;
+    uint groupCountZ;
+    uint simulatedLow;
+    uint simulatedHigh;
+} state;
@@ -0,0 +1,19 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+// storage buffers in the vertex stage are read only without vertexPipelineStoresAndAtomics
+#define PARTICLE_ACCESS readonly
+#include "particle.glsl"
+
+layout(location = 0) out vec3 fragColor;
+
+// One point per alive particle, the indirect draw sets the vertex count on the GPU.
+void main() {
+    uint index = alive[params.parity * params.maxParticles + uint(gl_VertexIndex)];
+    vec4 position = positions[index];
+    float age = position.w / velocities[index].w;
+    gl_Position = params.viewProjection * vec4(position.xyz, 1.0);
+    gl_PointSize = 1.0;
+    fragColor = mix(vec3(1.0, 0.85, 0.4), vec3(0.6, 0.1, 0.05), age);
+}
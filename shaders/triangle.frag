@@ -1,9 +1,28 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
+layout(constant_id = 2) const bool FOG = true;
+layout(constant_id = 3) const bool UBER = false;
+
+layout(push_constant) uniform ShaderSettings {
+    int colorMode;
+    bool lighting;
+    bool fog;
+} settings;
+
 layout(location = 0) out vec4 outColor;
 layout(location = 0) in vec3 fragColor;
 
+const vec3 fogColor = vec3(0.55, 0.60, 0.70);
+const float fogDensity = 0.012;
+
 void main() {
-    outColor = vec4(fragColor, 1.0);
-}
\ No newline at end of file
+    bool fog = UBER ? settings.fog : FOG;
+    vec3 color = fragColor;
+    if (fog) {
+        // 1 / w is the view-space depth for a perspective projection
+        float viewDepth = 1.0 / gl_FragCoord.w;
+        color = mix(fogColor, color, exp(-fogDensity * viewDepth));
+    }
+    outColor = vec4(color, 1.0);
+}
@@ -1,21 +1,53 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
-vec2 positions[3] = vec2[](
-    vec2(0.0, -0.5),
-    vec2(0.5, 0.5),
-    vec2(-0.5, 0.5)
-);
+// Every pipeline variant is this one module specialized at pipeline creation, the driver
+// folds the constants and drops the untaken branches. With UBER set the same choices are
+// read from push constants at run time instead.
+const int COLOR_MODE_ALBEDO = 0;
+const int COLOR_MODE_NORMAL = 1;
+const int COLOR_MODE_WHITE = 2;
+layout(constant_id = 0) const int COLOR_MODE = COLOR_MODE_ALBEDO;
+layout(constant_id = 1) const bool LIGHTING = true;
+layout(constant_id = 3) const bool UBER = false;
 
-vec3 colors[3] = vec3[](
-    vec3(1.0, 0.0, 0.0),
-    vec3(0.0, 1.0, 0.0),
-    vec3(0.0, 0.0, 1.0)
-);
+layout(push_constant) uniform ShaderSettings {
+    int colorMode;
+    bool lighting;
+    bool fog;
+} settings;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec2 inNormal;
+layout(location = 2) in vec2 inTexCoord;
+layout(location = 3) in mat4 inModelViewProjection;
 
 layout(location = 0) out vec3 fragColor;
 
+const vec3 lightDirection = vec3(0.40, 0.80, -0.45);
+
+vec3 octahedralDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+    return normalize(n);
+}
+
 void main() {
-    gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-    fragColor = colors[gl_VertexIndex];
-}
\ No newline at end of file
+    int colorMode = UBER ? settings.colorMode : COLOR_MODE;
+    bool lighting = UBER ? settings.lighting : LIGHTING;
+    gl_Position = inModelViewProjection * vec4(inPosition, 1.0);
+    vec3 normal = octahedralDecode(inNormal);
+    vec3 albedo;
+    if (colorMode == COLOR_MODE_NORMAL) {
+        albedo = 0.5 * normal + 0.5;
+    } else if (colorMode == COLOR_MODE_WHITE) {
+        albedo = vec3(1.0);
+    } else {
+        albedo = vec3(inTexCoord, 1.0 - inTexCoord.x - inTexCoord.y);
+    }
+    if (lighting) {
+        albedo *= 0.25 + 0.75 * max(dot(normal, normalize(lightDirection)), 0.0);
+    }
+    fragColor = albedo;
+}
@@ -2,12 +2,22 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stddef.h>
 #include <limits.h>
 #include <assert.h>
+#include <math.h>
+#include <time.h>
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include "mesh.h"
+#include "lod.h"
+#include "memory.h"
+#include "transform.h"
+#include "arena.h"
+#include "drawlist.h"
+
 #ifdef NDEBUG
     const bool enableValidationLayers = false;
 #else
@@ -24,6 +34,64 @@ const char *const deviceExtensions[] = {
 const int WIDTH = 800;
 const int HEIGHT = 600;
 const int MAX_FRAMES_IN_FLIGHT = 2;
+const char *const DEFAULT_MESH = "meshes/sphere.vmesh";
+const uint32_t GRID_SIZE = 64;
+const float GRID_SPACING = 4.0f;
+const float FIELD_OF_VIEW = 1.0471976f;
+const float LOD_THRESHOLD_PIXELS = 1.0f;
+const float NEAR_PLANE = 0.1f;
+const float FAR_PLANE = 1000.0f;
+const double FRAME_STATS_INTERVAL = 1.0;
+const size_t FRAME_ARENA_SIZE = 8u << 20;
+const uint32_t DRAW_BENCH_DRAWS = 100000;
+const float MEMORY_PRESSURE_THRESHOLD = 0.9f;
+/* radians per second every instance spins around its own y axis */
+const float SPIN_SPEED = 0.6f;
+/* frame rate cap of the on-demand mode while something animates, 0 for none */
+const double DEFAULT_MAX_FPS = 60.0;
+const uint32_t SHADER_BENCH_WARMUP_FRAMES = 16;
+const uint32_t SHADER_BENCH_FRAMES = 128;
+/* must match PARTICLE_GROUP_SIZE in shaders/particle.glsl */
+const uint32_t PARTICLE_GROUP_SIZE = 256;
+/* mean of the 3 to 5 seconds lifetime given in shaders/particle_emit.comp */
+const float PARTICLE_MEAN_LIFETIME = 4.0f;
+/* storage per particle: position and age, velocity and lifetime, two alive list entries and
+ * one dead list entry, see createParticleBuffers */
+const VkDeviceSize PARTICLE_BYTES = 8 * sizeof(float) + 3 * sizeof(uint32_t);
+const float PARTICLE_EMITTER[3] = {0.0f, 0.0f, 32.0f};
+const double PARTICLE_MAX_DELTA_TIME = 0.1;
+const uint32_t PARTICLE_BENCH_DEFAULT_COUNT = 4u << 20;
+const uint32_t PARTICLE_BENCH_FRAMES = 600;
+/* simulation steps per command buffer, keeps each one well below GPU watchdog timeouts */
+const uint32_t PARTICLE_BENCH_STEPS_PER_BATCH = 60;
+const float PARTICLE_BENCH_DELTA_TIME = 1.0f / 60.0f;
+
+/* Specialization constant values of one pipeline variant. The members are in constant_id
+ * order, the first three also form the push constant block read by the uber-shader. */
+typedef struct {
+    int32_t colorMode;
+    VkBool32 lighting;
+    VkBool32 fog;
+    VkBool32 uber;
+} ShaderVariant;
+
+enum {
+    COLOR_MODE_ALBEDO,
+    COLOR_MODE_NORMAL,
+    COLOR_MODE_WHITE
+};
+
+#define SHADER_VARIANT_COUNT 3
+const ShaderVariant shaderVariants[SHADER_VARIANT_COUNT] = {
+    {COLOR_MODE_ALBEDO, VK_TRUE, VK_TRUE, VK_FALSE},
+    {COLOR_MODE_NORMAL, VK_TRUE, VK_FALSE, VK_FALSE},
+    {COLOR_MODE_WHITE, VK_FALSE, VK_FALSE, VK_FALSE}
+};
+const char *const shaderVariantNames[SHADER_VARIANT_COUNT] = {
+    "lit albedo with fog",
+    "lit normals",
+    "unlit white"
+};
 
 typedef struct {
     VkInstance instance;
@@ -32,6 +100,8 @@ typedef struct {
     VkSurfaceKHR surface;
     VkQueue queue;
     uint32_t queueIndex;
+    bool memoryBudgetSupported;
+    MemoryTracker memoryTracker;
 } SurfaceAndDevice;
 
 typedef struct {
@@ -41,12 +111,20 @@ typedef struct {
     uint32_t imageCount;
     VkImage *images;
     VkImageView *imageViews;
+    VkFormat depthFormat;
+    VkImage depthImage;
+    VkDeviceMemory depthImageMemory;
+    VkImageView depthImageView;
 } SwapchainAndViews;
 
+/* The scene is drawn with specialized[variant], or with uber if useUber is set. */
 typedef struct {
     VkRenderPass renderPass;
     VkPipelineLayout pipelineLayout;
-    VkPipeline pipeline;
+    VkPipeline specialized[SHADER_VARIANT_COUNT];
+    VkPipeline uber;
+    uint32_t variant;
+    bool useUber;
 } Pipeline;
 
 typedef struct {
@@ -55,22 +133,258 @@ typedef struct {
     VkCommandBuffer *commandBuffers;
     VkSemaphore imageAvailableSemaphore;
     VkSemaphore renderFinishedSemaphore;
+    VkQueryPool timestampQueryPool;
+    double timestampPeriod;
 } Buffers;
 
+typedef struct {
+    MappedMesh mapped;
+    VkBuffer vertexBuffer;
+    VkDeviceMemory vertexBufferMemory;
+    VkBuffer indexBuffer;
+    VkDeviceMemory indexBufferMemory;
+    VkIndexType indexType;
+    uint32_t indexCount;
+    const MeshLod *lods;
+    uint32_t lodCount;
+    float center[3];
+    float radius;
+} MeshBuffers;
+
+/* The LOD instances share the position and scale arrays of the transforms. Only the visible
+ * instances are packed into the persistently mapped instance buffer, visibleInstances maps
+ * every slot back to its instance. */
+typedef struct {
+    TransformInstances transforms;
+    TransformBatch batch;
+    TransformIsa isa;
+    bool animate;
+    double lastUpdate;
+    LodInstances instances;
+    uint8_t *selectedLods;
+    bool lodEnabled;
+    LodCamera camera;
+    uint32_t *visibleInstances;
+    uint32_t visibleCount;
+    VkBuffer instanceBuffer;
+    VkDeviceMemory instanceBufferMemory;
+    InstanceData *instanceData;
+    FrameArena arena;
+} Scene;
+
+typedef struct {
+    double lastReport;
+    double lastFrame;
+    uint32_t frames;
+    double frameTimeSum;
+    uint64_t trianglesSubmitted;
+    uint32_t gpuFrames;
+    double gpuTimeSum;
+} FrameStats;
+
+/* What invalidated the last presented frame. */
+enum {
+    DAMAGE_INPUT = 1 << 0,
+    DAMAGE_SCENE = 1 << 1,
+    DAMAGE_TIMER = 1 << 2,
+    DAMAGE_WINDOW = 1 << 3
+};
+
+/* In on-demand mode the main loop blocks in glfwWaitEvents until something is damaged and
+ * redraws at most every frameInterval seconds. Continuous mode redraws as fast as possible.
+ * The loop statistics compare the CPU time of both. */
+typedef struct {
+    bool onDemand;
+    double frameInterval;
+    uint32_t damage;
+    double lastFrame;
+    double lastReport;
+    clock_t lastCpuTime;
+    uint32_t frames;
+} FrameScheduler;
+
+/* Renders every variant specialized and as uber-shader for SHADER_BENCH_FRAMES frames each
+ * and compares their GPU times. Step 2 * v is variant v specialized, 2 * v + 1 the uber-shader. */
+typedef struct {
+    bool running;
+    uint32_t step;
+    uint32_t frame;
+    double gpuTime[2 * SHADER_VARIANT_COUNT];
+    uint32_t previousVariant;
+    bool previousUseUber;
+} ShaderBenchmark;
+
+enum {
+    PARTICLE_BUFFER_POSITIONS,
+    PARTICLE_BUFFER_VELOCITIES,
+    PARTICLE_BUFFER_ALIVE,
+    PARTICLE_BUFFER_DEAD,
+    PARTICLE_BUFFER_STATE,
+    PARTICLE_BUFFER_COUNT
+};
+
+/* Compute passes in recording order, init runs only once. Prepare and finish are the two
+ * specializations of particle_args.comp. */
+enum {
+    PARTICLE_PASS_INIT,
+    PARTICLE_PASS_EMIT,
+    PARTICLE_PASS_PREPARE,
+    PARTICLE_PASS_SIMULATE,
+    PARTICLE_PASS_FINISH,
+    PARTICLE_PASS_COUNT
+};
+
+/* Contents of the state buffer, matches State in shaders/particle.glsl. The indirect
+ * commands are written by the GPU and consumed from this buffer in place. */
+typedef struct {
+    uint32_t aliveCount[2];
+    int32_t deadCount;
+    uint32_t frame;
+    VkDrawIndirectCommand draw;
+    VkDispatchIndirectCommand dispatch;
+    uint32_t simulatedLow;
+    uint32_t simulatedHigh;
+} ParticleState;
+
+/* Push constants of every particle pass, matches ParticleParams in shaders/particle.glsl. */
+typedef struct {
+    float viewProjection[16];
+    float emitterPosition[3];
+    float deltaTime;
+    uint32_t emitCount;
+    uint32_t parity;
+    uint32_t maxParticles;
+    uint32_t seed;
+} ParticleParams;
+
+/* GPU particles in device local storage buffers. After creation the CPU only pushes the
+ * time step and emission count, the particle count never comes back to the CPU. parity is
+ * the alive list the next simulation reads. render is VK_NULL_HANDLE in headless mode. */
+typedef struct {
+    uint32_t maxParticles;
+    float emitRate;
+    double emitRemainder;
+    float deltaTime;
+    uint32_t parity;
+    uint32_t seed;
+    bool initialized;
+    VkBuffer buffers[PARTICLE_BUFFER_COUNT];
+    VkDeviceMemory bufferMemory[PARTICLE_BUFFER_COUNT];
+    VkDescriptorSetLayout descriptorSetLayout;
+    VkDescriptorPool descriptorPool;
+    VkDescriptorSet descriptorSet;
+    VkPipelineLayout pipelineLayout;
+    VkPipeline compute[PARTICLE_PASS_COUNT];
+    VkPipeline render;
+} ParticleSystem;
+
 typedef struct {
     SurfaceAndDevice *surfaceAndDevice;
     SwapchainAndViews *swapchainAndViews;
     Pipeline *pipeline;
     Buffers *buffers;
+    MeshBuffers *meshBuffers;
+    Scene *scene;
+    FrameStats *frameStats;
+    ShaderBenchmark *shaderBenchmark;
+    FrameScheduler *scheduler;
+    ParticleSystem *particles;
 } VulkanStuff;
 
 static void error_callback(int error, const char *description) {
     fprintf(stderr, "Error: %s\n", description);
 }
 
+void selectShaderVariant(Pipeline *pipeline, uint32_t variant, bool useUber) {
+    pipeline->variant = variant;
+    pipeline->useUber = useUber;
+}
+
+void startShaderBenchmark(VulkanStuff *vulkan) {
+    ShaderBenchmark *benchmark = vulkan->shaderBenchmark;
+    if (benchmark->running) return;
+    if (vulkan->buffers->timestampQueryPool == VK_NULL_HANDLE) {
+        fprintf(stderr, "ERROR shader bench: GPU timestamps are not supported\n");
+        return;
+    }
+    memset(benchmark, 0, sizeof(*benchmark));
+    benchmark->running = true;
+    benchmark->previousVariant = vulkan->pipeline->variant;
+    benchmark->previousUseUber = vulkan->pipeline->useUber;
+    selectShaderVariant(vulkan->pipeline, 0, false);
+    printf("INFO shader bench: %u variants, %u frames each\n", SHADER_VARIANT_COUNT, SHADER_BENCH_FRAMES);
+}
+
+void updateShaderBenchmark(VulkanStuff *vulkan, double gpuTime) {
+    ShaderBenchmark *benchmark = vulkan->shaderBenchmark;
+    if (!benchmark->running) return;
+    if (benchmark->frame >= SHADER_BENCH_WARMUP_FRAMES) {
+        benchmark->gpuTime[benchmark->step] += gpuTime;
+    }
+    if (++benchmark->frame < SHADER_BENCH_WARMUP_FRAMES + SHADER_BENCH_FRAMES) return;
+    benchmark->frame = 0;
+    if (++benchmark->step < 2 * SHADER_VARIANT_COUNT) {
+        selectShaderVariant(vulkan->pipeline, benchmark->step / 2, benchmark->step % 2 == 1);
+        return;
+    }
+    for (uint32_t v = 0; v < SHADER_VARIANT_COUNT; ++v) {
+        double specialized = benchmark->gpuTime[2 * v] / SHADER_BENCH_FRAMES;
+        double uber = benchmark->gpuTime[2 * v + 1] / SHADER_BENCH_FRAMES;
+        printf("INFO shader bench: %-20s specialized %.3f ms, uber-shader %.3f ms (%+.1f%%)\n",
+               shaderVariantNames[v], specialized, uber, specialized > 0.0 ? 100.0 * (uber - specialized) / specialized : 0.0);
+    }
+    benchmark->running = false;
+    selectShaderVariant(vulkan->pipeline, benchmark->previousVariant, benchmark->previousUseUber);
+}
+
+void runDrawBenchmark(VulkanStuff *vulkan);
+
 static void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods) {
     if (action == GLFW_RELEASE) printf("Key pressed: %i\n", key);
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) glfwSetWindowShouldClose(window, GLFW_TRUE);
+    VulkanStuff *vulkan = (VulkanStuff *) glfwGetWindowUserPointer(window);
+    if (vulkan == NULL) return;
+    vulkan->scheduler->damage |= DAMAGE_INPUT;
+    if (key == GLFW_KEY_L && action == GLFW_PRESS) {
+        vulkan->scene->lodEnabled = !vulkan->scene->lodEnabled;
+        printf("INFO scene: LOD selection %s\n", vulkan->scene->lodEnabled ? "on" : "off");
+    }
+    if (key == GLFW_KEY_M && action == GLFW_PRESS && !vulkan->shaderBenchmark->running) {
+        Pipeline *pipeline = vulkan->pipeline;
+        selectShaderVariant(pipeline, (pipeline->variant + 1) % SHADER_VARIANT_COUNT, pipeline->useUber);
+        printf("INFO scene: shading %s\n", shaderVariantNames[pipeline->variant]);
+    }
+    if (key == GLFW_KEY_U && action == GLFW_PRESS && !vulkan->shaderBenchmark->running) {
+        Pipeline *pipeline = vulkan->pipeline;
+        selectShaderVariant(pipeline, pipeline->variant, !pipeline->useUber);
+        printf("INFO scene: %s pipeline\n", pipeline->useUber ? "uber-shader" : "specialized");
+    }
+    if (key == GLFW_KEY_B && action == GLFW_PRESS) {
+        startShaderBenchmark(vulkan);
+    }
+    if (key == GLFW_KEY_D && action == GLFW_PRESS && !vulkan->shaderBenchmark->running) {
+        runDrawBenchmark(vulkan);
+    }
+    if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+        vulkan->scene->animate = !vulkan->scene->animate;
+        vulkan->scene->lastUpdate = glfwGetTime();
+        printf("INFO scene: animation %s\n", vulkan->scene->animate ? "on" : "off");
+    }
+    if (key == GLFW_KEY_I && action == GLFW_PRESS) {
+        vulkan->scheduler->onDemand = !vulkan->scheduler->onDemand;
+        printf("INFO loop: %s rendering\n", vulkan->scheduler->onDemand ? "on-demand" : "continuous");
+    }
+    if (action == GLFW_PRESS) vulkan->scheduler->damage |= DAMAGE_SCENE;
+}
+
+static void refresh_callback(GLFWwindow *window) {
+    VulkanStuff *vulkan = (VulkanStuff *) glfwGetWindowUserPointer(window);
+    if (vulkan != NULL) vulkan->scheduler->damage |= DAMAGE_WINDOW;
+}
+
+static void memory_pressure_callback(uint32_t heapIndex, VkDeviceSize usage, VkDeviceSize budget, void *userData) {
+    fprintf(stderr, "WARNING memory: heap %u at %.1f of %.1f MiB budget\n", heapIndex,
+            usage / (1024.0 * 1024.0), budget / (1024.0 * 1024.0));
 }
 
 size_t readShaderFromFile(const char filename[], uint32_t **shaderContent) {
@@ -126,6 +440,372 @@ void initWindow(GLFWwindow **window) {
         exit(EXIT_FAILURE);
     }
     glfwSetKeyCallback(*window, key_callback);
+    glfwSetWindowRefreshCallback(*window, refresh_callback);
+}
+
+void mat4Multiply(const float a[16], const float b[16], float result[16]) {
+    for (uint32_t column = 0; column < 4; ++column) {
+        for (uint32_t row = 0; row < 4; ++row) {
+            float sum = 0.0f;
+            for (uint32_t k = 0; k < 4; ++k) {
+                sum += a[k * 4 + row] * b[column * 4 + k];
+            }
+            result[column * 4 + row] = sum;
+        }
+    }
+}
+
+/* Right handed perspective projection onto Vulkan clip space: depth in [0, 1], y pointing down. */
+void mat4Perspective(float fovy, float aspect, float near, float far, float result[16]) {
+    float f = 1.0f / tanf(fovy / 2.0f);
+    memset(result, 0, 16 * sizeof(float));
+    result[0] = f / aspect;
+    result[5] = -f;
+    result[10] = far / (near - far);
+    result[11] = -1.0f;
+    result[14] = near * far / (near - far);
+}
+
+void mat4LookAt(const float eye[3], const float center[3], const float up[3], float result[16]) {
+    float f[3] = {center[0] - eye[0], center[1] - eye[1], center[2] - eye[2]};
+    float length = sqrtf(f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+    f[0] /= length; f[1] /= length; f[2] /= length;
+    float s[3] = {f[1] * up[2] - f[2] * up[1], f[2] * up[0] - f[0] * up[2], f[0] * up[1] - f[1] * up[0]};
+    length = sqrtf(s[0] * s[0] + s[1] * s[1] + s[2] * s[2]);
+    s[0] /= length; s[1] /= length; s[2] /= length;
+    float u[3] = {s[1] * f[2] - s[2] * f[1], s[2] * f[0] - s[0] * f[2], s[0] * f[1] - s[1] * f[0]};
+    memset(result, 0, 16 * sizeof(float));
+    for (uint32_t k = 0; k < 3; ++k) {
+        result[k * 4 + 0] = s[k];
+        result[k * 4 + 1] = u[k];
+        result[k * 4 + 2] = -f[k];
+    }
+    result[12] = -(s[0] * eye[0] + s[1] * eye[1] + s[2] * eye[2]);
+    result[13] = -(u[0] * eye[0] + u[1] * eye[1] + u[2] * eye[2]);
+    result[14] = f[0] * eye[0] + f[1] * eye[1] + f[2] * eye[2];
+    result[15] = 1.0f;
+}
+
+/* Emitter state: pipeline ids below SHADER_VARIANT_COUNT are the specialized pipelines,
+ * SHADER_VARIANT_COUNT is the uber-shader. A material is the shader variant pushed as push
+ * constants, a mesh one LOD, bound as index buffer offset. */
+typedef struct {
+    VkCommandBuffer commandBuffer;
+    Pipeline *pipeline;
+    MeshBuffers *meshBuffers;
+    uint64_t triangles;
+} DrawContext;
+
+static void emitBindPipeline(void *context, uint32_t pipelineId) {
+    DrawContext *draw = (DrawContext *) context;
+    VkPipeline pipeline = pipelineId < SHADER_VARIANT_COUNT ? draw->pipeline->specialized[pipelineId] : draw->pipeline->uber;
+    vkCmdBindPipeline(draw->commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+}
+
+static void emitBindMaterial(void *context, uint32_t material) {
+    DrawContext *draw = (DrawContext *) context;
+    vkCmdPushConstants(draw->commandBuffer, draw->pipeline->pipelineLayout,
+                       VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+                       0, offsetof(ShaderVariant, uber), &shaderVariants[material]);
+}
+
+static void emitBindMesh(void *context, uint32_t mesh) {
+    DrawContext *draw = (DrawContext *) context;
+    MeshBuffers *meshBuffers = draw->meshBuffers;
+    VkDeviceSize indexSize = meshBuffers->indexType == VK_INDEX_TYPE_UINT16 ? 2 : 4;
+    vkCmdBindIndexBuffer(draw->commandBuffer, meshBuffers->indexBuffer, meshBuffers->lods[mesh].indexOffset * indexSize,
+                         meshBuffers->indexType);
+}
+
+static void emitDraw(void *context, const DrawCommand *command) {
+    DrawContext *draw = (DrawContext *) context;
+    vkCmdDrawIndexed(draw->commandBuffer, command->indexCount, 1, command->firstIndex, 0, command->firstInstance);
+    draw->triangles += command->indexCount / 3;
+}
+
+uint32_t particleGroupCount(uint32_t count) {
+    return (count + PARTICLE_GROUP_SIZE - 1) / PARTICLE_GROUP_SIZE;
+}
+
+void particleBarrier(VkCommandBuffer commandBuffer, VkPipelineStageFlags srcStage, VkAccessFlags srcAccess,
+                     VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) {
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 1, &barrier, 0, NULL, 0, NULL);
+}
+
+/* Records one simulation step: emit, size the indirect dispatch, simulate every alive
+ * particle and size the indirect draw. Every count stays on the GPU. */
+void recordParticleSimulation(ParticleSystem *particles, VkCommandBuffer commandBuffer, float deltaTime) {
+    ParticleParams params = {};
+    memcpy(params.emitterPosition, PARTICLE_EMITTER, sizeof(params.emitterPosition));
+    params.deltaTime = deltaTime;
+    params.parity = particles->parity;
+    params.maxParticles = particles->maxParticles;
+    params.seed = particles->seed++;
+    // carry the fractional particle over, so that low rates and short frames still emit
+    double emit = particles->emitRemainder + particles->emitRate * deltaTime;
+    params.emitCount = emit < particles->maxParticles ? (uint32_t) emit : particles->maxParticles;
+    particles->emitRemainder = emit < particles->maxParticles ? emit - params.emitCount : 0.0;
+
+    const VkAccessFlags shaderAccess = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    // the previous frame may still draw from the alive list written by its simulation
+    particleBarrier(commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0,
+                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, shaderAccess);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, particles->pipelineLayout, 0, 1,
+                            &particles->descriptorSet, 0, NULL);
+    vkCmdPushConstants(commandBuffer, particles->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT,
+                       0, sizeof(params), &params);
+    if (!particles->initialized) {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, particles->compute[PARTICLE_PASS_INIT]);
+        vkCmdDispatch(commandBuffer, particleGroupCount(particles->maxParticles), 1, 1);
+        particleBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, shaderAccess);
+        particles->initialized = true;
+    }
+    if (params.emitCount > 0) {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, particles->compute[PARTICLE_PASS_EMIT]);
+        vkCmdDispatch(commandBuffer, particleGroupCount(params.emitCount), 1, 1);
+        particleBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, shaderAccess);
+    }
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, particles->compute[PARTICLE_PASS_PREPARE]);
+    vkCmdDispatch(commandBuffer, 1, 1, 1);
+    particleBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                    VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_INDIRECT_COMMAND_READ_BIT | shaderAccess);
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, particles->compute[PARTICLE_PASS_SIMULATE]);
+    vkCmdDispatchIndirect(commandBuffer, particles->buffers[PARTICLE_BUFFER_STATE], offsetof(ParticleState, dispatch));
+    particleBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, shaderAccess);
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, particles->compute[PARTICLE_PASS_FINISH]);
+    vkCmdDispatch(commandBuffer, 1, 1, 1);
+    // the draw reads the survivors, the next simulation step everything
+    particleBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                    VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_INDIRECT_COMMAND_READ_BIT | shaderAccess);
+    particles->parity = 1 - particles->parity;
+}
+
+/* One point per survivor of the last recorded simulation step, inside the render pass. */
+void recordParticleDraw(ParticleSystem *particles, VkCommandBuffer commandBuffer, const float viewProjection[16]) {
+    ParticleParams params = {};
+    memcpy(params.viewProjection, viewProjection, sizeof(params.viewProjection));
+    params.parity = particles->parity;
+    params.maxParticles = particles->maxParticles;
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, particles->render);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, particles->pipelineLayout, 0, 1,
+                            &particles->descriptorSet, 0, NULL);
+    vkCmdPushConstants(commandBuffer, particles->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT,
+                       0, sizeof(params), &params);
+    vkCmdDrawIndirect(commandBuffer, particles->buffers[PARTICLE_BUFFER_STATE], offsetof(ParticleState, draw), 1,
+                      sizeof(VkDrawIndirectCommand));
+}
+
+/* One draw per visible instance, the slot in the instance buffer is its first instance. */
+bool buildDrawList(VulkanStuff *vulkan, DrawList *drawList) {
+    Scene *scene = vulkan->scene;
+    Pipeline *pipeline = vulkan->pipeline;
+    if (!beginDrawList(drawList, &scene->arena, scene->visibleCount)) {
+        return false;
+    }
+    uint32_t pipelineId = pipeline->useUber ? SHADER_VARIANT_COUNT : pipeline->variant;
+    for (uint32_t slot = 0; slot < scene->visibleCount; ++slot) {
+        uint32_t i = scene->visibleInstances[slot];
+        uint32_t lod = scene->lodEnabled ? scene->selectedLods[i] : 0;
+        float dx = scene->instances.centerX[i] - scene->camera.position[0];
+        float dy = scene->instances.centerY[i] - scene->camera.position[1];
+        float dz = scene->instances.centerZ[i] - scene->camera.position[2];
+        float depth = sqrtf(dx * dx + dy * dy + dz * dz) / FAR_PLANE;
+        pushDraw(drawList, drawKey(pipelineId, pipeline->variant, lod, depth), 0, vulkan->meshBuffers->lods[lod].indexCount, slot);
+    }
+    return sortDrawList(drawList);
+}
+
+/* With particles set, the particle simulation runs before the render pass and the particles
+ * are drawn after the scene. The simulation is recorded ahead of the frame timestamps, which
+ * only time the render pass. */
+DrawStats recordDrawList(VulkanStuff *vulkan, VkCommandBuffer commandBuffer, VkFramebuffer framebuffer,
+                         const DrawList *drawList, ParticleSystem *particles, uint64_t *triangles) {
+    MeshBuffers *meshBuffers = vulkan->meshBuffers;
+    vkResetCommandBuffer(commandBuffer, 0);
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    beginInfo.pInheritanceInfo = NULL;
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+        fprintf(stderr, "ERROR Vulkan: failed to begin recording command buffer\n");
+    }
+    VkRenderPassBeginInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = vulkan->pipeline->renderPass;
+    renderPassInfo.framebuffer = framebuffer;
+    renderPassInfo.renderArea.offset.x = 0;
+    renderPassInfo.renderArea.offset.y = 0;
+    renderPassInfo.renderArea.extent = vulkan->swapchainAndViews->imageExtent;
+    VkClearValue clearValues[2] = {};
+    clearValues[0].color.float32[3] = 1.0f;
+    clearValues[1].depthStencil.depth = 1.0f;
+    clearValues[1].depthStencil.stencil = 0;
+    renderPassInfo.clearValueCount = 2;
+    renderPassInfo.pClearValues = clearValues;
+    if (particles != NULL) {
+        recordParticleSimulation(particles, commandBuffer, particles->deltaTime);
+    }
+    VkQueryPool queryPool = vulkan->buffers->timestampQueryPool;
+    if (queryPool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(commandBuffer, queryPool, 0, 2);
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+    }
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        VkBuffer vertexBuffers[] = {meshBuffers->vertexBuffer, vulkan->scene->instanceBuffer};
+        VkDeviceSize offsets[] = {0, 0};
+        vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+        DrawContext context = {commandBuffer, vulkan->pipeline, meshBuffers, 0};
+        DrawEmitter emitter = {&context, emitBindPipeline, emitBindMaterial, emitBindMesh, emitDraw};
+        DrawStats stats = emitDrawList(drawList, &emitter);
+        if (particles != NULL) {
+            recordParticleDraw(particles, commandBuffer, vulkan->scene->batch.viewProjection);
+        }
+    vkCmdEndRenderPass(commandBuffer);
+    if (queryPool != VK_NULL_HANDLE) {
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+    }
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        fprintf(stderr, "ERROR Vulkan: failed to record command buffer\n");
+    }
+    if (triangles != NULL) *triangles = context.triangles;
+    return stats;
+}
+
+uint64_t recordCommandBuffer(VulkanStuff *vulkan, uint32_t imageIndex) {
+    DrawList drawList;
+    uint64_t triangles = 0;
+    frameArenaReset(&vulkan->scene->arena);
+    if (!buildDrawList(vulkan, &drawList)) {
+        drawList.count = 0;
+    }
+    recordDrawList(vulkan, vulkan->buffers->commandBuffers[imageIndex], vulkan->buffers->framebuffers[imageIndex],
+                   &drawList, vulkan->particles, &triangles);
+    return triangles;
+}
+
+/* Records DRAW_BENCH_DRAWS draws with random pipeline, material, mesh and depth, once in
+ * submission order and once sorted, into a command buffer of its own that is never
+ * submitted. The draws only use instance slots written by the last frame. */
+void runDrawBenchmark(VulkanStuff *vulkan) {
+    Scene *scene = vulkan->scene;
+    MeshBuffers *meshBuffers = vulkan->meshBuffers;
+    VkDevice device = vulkan->surfaceAndDevice->device;
+    VkCommandPool commandPool = vulkan->buffers->commandPool;
+    VkFramebuffer framebuffer = vulkan->buffers->framebuffers[0];
+    DrawList drawList;
+    frameArenaReset(&scene->arena);
+    if (!beginDrawList(&drawList, &scene->arena, DRAW_BENCH_DRAWS)) {
+        return;
+    }
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+    VkCommandBuffer commandBuffer;
+    if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+        fprintf(stderr, "ERROR draw bench: failed to allocate command buffer\n");
+        return;
+    }
+    srand(1);
+    for (uint32_t i = 0; i < DRAW_BENCH_DRAWS; ++i) {
+        uint32_t lod = (uint32_t) rand() % meshBuffers->lodCount;
+        uint64_t key = drawKey((uint32_t) rand() % (SHADER_VARIANT_COUNT + 1), (uint32_t) rand() % SHADER_VARIANT_COUNT,
+                               lod, (float) rand() / (float) RAND_MAX);
+        pushDraw(&drawList, key, 0, meshBuffers->lods[lod].indexCount,
+                 scene->visibleCount > 0 ? i % scene->visibleCount : 0);
+    }
+    double start = glfwGetTime();
+    DrawStats unsorted = recordDrawList(vulkan, commandBuffer, framebuffer, &drawList, NULL, NULL);
+    double unsortedTime = glfwGetTime() - start;
+    start = glfwGetTime();
+    bool sorted = sortDrawList(&drawList);
+    double sortTime = glfwGetTime() - start;
+    start = glfwGetTime();
+    DrawStats sortedStats = recordDrawList(vulkan, commandBuffer, framebuffer, &drawList, NULL, NULL);
+    double sortedTime = glfwGetTime() - start;
+    vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+    if (!sorted) {
+        fprintf(stderr, "ERROR draw bench: frame arena too small for sorting\n");
+        return;
+    }
+    printf("INFO draw bench: %u draws, frame arena peak %.1f MiB\n", unsorted.draws, scene->arena.peak / (1024.0 * 1024.0));
+    printf("INFO draw bench: unsorted %6u pipeline, %6u material, %6u mesh binds, record %.3f ms\n",
+           unsorted.pipelineBinds, unsorted.materialBinds, unsorted.meshBinds, 1000.0 * unsortedTime);
+    printf("INFO draw bench: sorted   %6u pipeline, %6u material, %6u mesh binds, record %.3f ms + radix sort %.3f ms\n",
+           sortedStats.pipelineBinds, sortedStats.materialBinds, sortedStats.meshBinds, 1000.0 * sortedTime, 1000.0 * sortTime);
+}
+
+/* The instance buffer is overwritten every frame, this is safe because drawFrame waits for
+ * the queue to become idle before the next frame starts. */
+void updateScene(VulkanStuff *vulkan) {
+    Scene *scene = vulkan->scene;
+    double now = glfwGetTime();
+    if (scene->animate) {
+        // advance by the elapsed time so that the speed does not depend on the frame rate
+        float halfAngle = 0.5f * SPIN_SPEED * (float) (now - scene->lastUpdate);
+        float spin[4] = {0.0f, sinf(halfAngle), 0.0f, cosf(halfAngle)};
+        animateTransforms(&scene->transforms, spin, scene->isa);
+    }
+    if (vulkan->particles != NULL) {
+        // paused with the rest of the scene, and without a huge step after a long stall
+        double deltaTime = scene->animate ? now - scene->lastUpdate : 0.0;
+        vulkan->particles->deltaTime = (float) (deltaTime < PARTICLE_MAX_DELTA_TIME ? deltaTime : PARTICLE_MAX_DELTA_TIME);
+    }
+    scene->lastUpdate = now;
+    scene->visibleCount = updateInstanceData(&scene->transforms, &scene->batch, scene->isa,
+                                             scene->instanceData, scene->visibleInstances);
+    if (scene->lodEnabled) {
+        selectLods(&scene->instances, &scene->camera, vulkan->meshBuffers->lods, vulkan->meshBuffers->lodCount, scene->selectedLods);
+    }
+}
+
+/* Milliseconds between the two timestamps written by the last recorded frame, negative
+ * without timestamp support. Only valid after the frame has finished executing. */
+double readGpuTime(VkDevice device, Buffers *buffers) {
+    if (buffers->timestampQueryPool == VK_NULL_HANDLE) return -1.0;
+    uint64_t timestamps[2];
+    if (vkGetQueryPoolResults(device, buffers->timestampQueryPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+                              VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT) != VK_SUCCESS) {
+        return -1.0;
+    }
+    return 1e-6 * buffers->timestampPeriod * (double) (timestamps[1] - timestamps[0]);
+}
+
+void updateFrameStats(FrameStats *frameStats, MemoryTracker *memoryTracker, uint64_t triangles, double gpuTime, bool lodEnabled) {
+    double now = glfwGetTime();
+    frameStats->frames++;
+    frameStats->frameTimeSum += now - frameStats->lastFrame;
+    frameStats->trianglesSubmitted += triangles;
+    frameStats->lastFrame = now;
+    if (gpuTime >= 0.0) {
+        frameStats->gpuFrames++;
+        frameStats->gpuTimeSum += gpuTime;
+    }
+    if (now - frameStats->lastReport >= FRAME_STATS_INTERVAL) {
+        printf("INFO frame: %.3f ms, GPU %.3f ms, %.0f triangles submitted, LOD %s\n",
+               1000.0 * frameStats->frameTimeSum / frameStats->frames,
+               frameStats->gpuFrames > 0 ? frameStats->gpuTimeSum / frameStats->gpuFrames : 0.0,
+               (double) frameStats->trianglesSubmitted / frameStats->frames,
+               lodEnabled ? "on" : "off");
+        updateMemoryBudget(memoryTracker);
+        printMemoryStats(memoryTracker);
+        frameStats->lastReport = now;
+        frameStats->frames = 0;
+        frameStats->frameTimeSum = 0.0;
+        frameStats->trianglesSubmitted = 0;
+        frameStats->gpuFrames = 0;
+        frameStats->gpuTimeSum = 0.0;
+    }
 }
 
 void drawFrame(VulkanStuff *vulkan) {
@@ -133,6 +813,8 @@ void drawFrame(VulkanStuff *vulkan) {
     VkDevice device = vulkan->surfaceAndDevice->device;
     VkSwapchainKHR swapchain = vulkan->swapchainAndViews->swapchain;
     vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, vulkan->buffers->imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+    updateScene(vulkan);
+    uint64_t triangles = recordCommandBuffer(vulkan, imageIndex);
     
     VkSubmitInfo submitInfo = {};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -161,12 +843,58 @@ void drawFrame(VulkanStuff *vulkan) {
     presentInfo.pResults = NULL;
     vkQueuePresentKHR(vulkan->surfaceAndDevice->queue, &presentInfo);
     vkQueueWaitIdle(vulkan->surfaceAndDevice->queue);
+    double gpuTime = readGpuTime(device, vulkan->buffers);
+    updateFrameStats(vulkan->frameStats, &vulkan->surfaceAndDevice->memoryTracker, triangles, gpuTime, vulkan->scene->lodEnabled);
+    updateShaderBenchmark(vulkan, gpuTime);
 }
 
+void reportLoopStats(FrameScheduler *scheduler, double now) {
+    double elapsed = now - scheduler->lastReport;
+    if (elapsed < FRAME_STATS_INTERVAL) return;
+    clock_t cpuTime = clock();
+    double cpuSeconds = (double) (cpuTime - scheduler->lastCpuTime) / CLOCKS_PER_SEC;
+    printf("INFO loop: %s, %.1f frames/s, CPU %.1f%% of one core\n",
+           scheduler->onDemand ? "on-demand" : "continuous",
+           scheduler->frames / elapsed, 100.0 * cpuSeconds / elapsed);
+    scheduler->lastReport = now;
+    scheduler->lastCpuTime = cpuTime;
+    scheduler->frames = 0;
+}
+
+/* Continuous animation, like the spinning instances or a running shader benchmark, damages
+ * the frame on every tick of the frame rate cap. Without damage the loop sleeps until the
+ * next event, waking up only for the loop statistics. */
 void mainLoop(GLFWwindow *window, VulkanStuff *vulkan) {
+    FrameScheduler *scheduler = vulkan->scheduler;
+    scheduler->damage = DAMAGE_WINDOW;
+    scheduler->lastReport = glfwGetTime();
+    scheduler->lastCpuTime = clock();
     while (!glfwWindowShouldClose(window)) {
-        glfwPollEvents();
-        drawFrame(vulkan);
+        bool benchmarking = vulkan->shaderBenchmark->running;
+        bool animating = vulkan->scene->animate || benchmarking;
+        double frameInterval = benchmarking ? 0.0 : scheduler->frameInterval;
+        double nextFrame = scheduler->lastFrame + frameInterval;
+        if (scheduler->onDemand) {
+            double wakeup = scheduler->lastReport + FRAME_STATS_INTERVAL;
+            if ((scheduler->damage != 0 || animating) && nextFrame < wakeup) wakeup = nextFrame;
+            double timeout = wakeup - glfwGetTime();
+            if (timeout > 0.0) {
+                glfwWaitEventsTimeout(timeout);
+            } else {
+                glfwPollEvents();
+            }
+        } else {
+            glfwPollEvents();
+        }
+        double now = glfwGetTime();
+        if (animating) scheduler->damage |= DAMAGE_TIMER;
+        if (!scheduler->onDemand || (scheduler->damage != 0 && now >= nextFrame)) {
+            drawFrame(vulkan);
+            scheduler->damage = 0;
+            scheduler->lastFrame = now;
+            scheduler->frames++;
+        }
+        reportLoopStats(scheduler, now);
     }
     vkDeviceWaitIdle(vulkan->surfaceAndDevice->device);
 }
@@ -193,7 +921,8 @@ bool checkValidationLayerSupport() {
     return true;
 }
 
-void createInstance(SurfaceAndDevice *surfaceAndDevice) {
+/* Headless instances enable no extensions, so that they work without a window system. */
+void createInstance(SurfaceAndDevice *surfaceAndDevice, bool headless) {
     if (enableValidationLayers && !checkValidationLayerSupport()) {
         fprintf(stderr, "ERROR Vulkan: validation layers requested but not available\n");
     }
@@ -208,8 +937,10 @@ void createInstance(SurfaceAndDevice *surfaceAndDevice) {
     createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
     createInfo.pApplicationInfo = &appInfo;
     uint32_t glfwExtensionCount = 0;
-    const char **glfwExtensions;
-    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    const char **glfwExtensions = NULL;
+    if (!headless) {
+        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    }
     createInfo.enabledExtensionCount = glfwExtensionCount;
     createInfo.ppEnabledExtensionNames = glfwExtensions;
     if (enableValidationLayers) {
@@ -245,6 +976,35 @@ bool findGraphicsQueueFamilyIndex(VkPhysicalDevice device, VkSurfaceKHR surface,
     return graphicsQueueSupported;
 }
 
+bool findComputeQueueFamilyIndex(VkPhysicalDevice device, uint32_t *computeFamilyIndex) {
+    uint32_t queueFamilyCount = 0;
+    VkQueueFamilyProperties *queueFamilies;
+    bool computeQueueSupported = false;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, NULL);
+    queueFamilies = (VkQueueFamilyProperties *) malloc(queueFamilyCount * sizeof(VkQueueFamilyProperties));
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies);
+    for (uint32_t i = 0; i < queueFamilyCount; ++i) {
+        if (queueFamilies[i].queueCount > 0 && queueFamilies[i].queueFlags & VK_QUEUE_COMPUTE_BIT) {
+            computeQueueSupported = true;
+            if (computeFamilyIndex != NULL) *computeFamilyIndex = i;
+            break;
+        }
+    }
+    free(queueFamilies);
+    return computeQueueSupported;
+}
+
+bool checkQueueFamilySupport(VkPhysicalDevice device, uint32_t queueFamilyIndex, VkQueueFlags flags) {
+    uint32_t queueFamilyCount = 0;
+    VkQueueFamilyProperties *queueFamilies;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, NULL);
+    queueFamilies = (VkQueueFamilyProperties *) malloc(queueFamilyCount * sizeof(VkQueueFamilyProperties));
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies);
+    bool supported = queueFamilyIndex < queueFamilyCount && (queueFamilies[queueFamilyIndex].queueFlags & flags) == flags;
+    free(queueFamilies);
+    return supported;
+}
+
 bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
     bool requiredExtensionsSupported = true;
     uint32_t extensionCount;
@@ -266,6 +1026,23 @@ bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
     return requiredExtensionsSupported;
 }
 
+bool checkOptionalDeviceExtensionSupport(VkPhysicalDevice device, const char extensionName[]) {
+    bool supported = false;
+    uint32_t extensionCount;
+    VkExtensionProperties *availableExtensions;
+    vkEnumerateDeviceExtensionProperties(device, NULL, &extensionCount, NULL);
+    availableExtensions = (VkExtensionProperties *) malloc(extensionCount * sizeof(VkExtensionProperties));
+    vkEnumerateDeviceExtensionProperties(device, NULL, &extensionCount, availableExtensions);
+    for (uint32_t i = 0; i < extensionCount; ++i) {
+        if (strcmp(extensionName, availableExtensions[i].extensionName) == 0) {
+            supported = true;
+            break;
+        }
+    }
+    free(availableExtensions);
+    return supported;
+}
+
 VkSurfaceFormatKHR chooseSwapSurfaceFormat(VkSurfaceFormatKHR *availableFormats, uint32_t formatCount) {
     for (uint32_t i = 0; i < formatCount; ++i) {
         if (   availableFormats[i].format == VK_FORMAT_B8G8R8A8_UNORM 
@@ -384,6 +1161,7 @@ bool isDeviceSuitable(VkPhysicalDevice device, VkSurfaceKHR surface) {
     return queueAdequate && extensionsSupported && swapChainAdequate;
 }
 
+/* Without a surface any GPU with a compute queue will do. */
 void pickPhysicalDevice(SurfaceAndDevice *surfaceAndDevice) {
     surfaceAndDevice->physicalDevice = VK_NULL_HANDLE;
     uint32_t deviceCount = 0;
@@ -395,7 +1173,10 @@ void pickPhysicalDevice(SurfaceAndDevice *surfaceAndDevice) {
     availableDevices = (VkPhysicalDevice *) malloc(deviceCount * sizeof(VkPhysicalDevice));
     vkEnumeratePhysicalDevices(surfaceAndDevice->instance, &deviceCount, availableDevices);
     for (uint32_t i = 0; i < deviceCount; ++i) {
-        if (isDeviceSuitable(availableDevices[i], surfaceAndDevice->surface)) {
+        bool suitable = surfaceAndDevice->surface == VK_NULL_HANDLE
+            ? findComputeQueueFamilyIndex(availableDevices[i], NULL)
+            : isDeviceSuitable(availableDevices[i], surfaceAndDevice->surface);
+        if (suitable) {
             surfaceAndDevice->physicalDevice = availableDevices[i];
             break;
         }
@@ -408,8 +1189,14 @@ void pickPhysicalDevice(SurfaceAndDevice *surfaceAndDevice) {
     free(availableDevices);
 }
 
+/* Headless devices, without a surface, get a compute queue and no swapchain. */
 void createLogicalDevice(SurfaceAndDevice *surfaceAndDevice) {
-    if (!findGraphicsQueueFamilyIndex(surfaceAndDevice->physicalDevice, surfaceAndDevice->surface, &surfaceAndDevice->queueIndex)) {
+    bool headless = surfaceAndDevice->surface == VK_NULL_HANDLE;
+    if (headless) {
+        if (!findComputeQueueFamilyIndex(surfaceAndDevice->physicalDevice, &surfaceAndDevice->queueIndex)) {
+            fprintf(stderr, "ERROR Vulkan: Could not find compute queue\n");
+        }
+    } else if (!findGraphicsQueueFamilyIndex(surfaceAndDevice->physicalDevice, surfaceAndDevice->surface, &surfaceAndDevice->queueIndex)) {
         fprintf(stderr, "ERROR Vulkan: Could not find graphics queue\n");
     }
     VkDeviceQueueCreateInfo queueCreateInfo = {};
@@ -430,8 +1217,21 @@ void createLogicalDevice(SurfaceAndDevice *surfaceAndDevice) {
     } else {
         createInfo.enabledLayerCount = 0;
     }
-    createInfo.enabledExtensionCount = deviceExtensionsCount;
-    createInfo.ppEnabledExtensionNames = deviceExtensions;
+    // VK_EXT_memory_budget is optional and needs vkGetPhysicalDeviceMemoryProperties2 from Vulkan 1.1.
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(surfaceAndDevice->physicalDevice, &deviceProperties);
+    surfaceAndDevice->memoryBudgetSupported = deviceProperties.apiVersion >= VK_API_VERSION_1_1
+        && checkOptionalDeviceExtensionSupport(surfaceAndDevice->physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    const char *enabledExtensions[deviceExtensionsCount + 1];
+    uint32_t enabledExtensionsCount = 0;
+    for (uint32_t i = 0; i < deviceExtensionsCount && !headless; ++i) {
+        enabledExtensions[enabledExtensionsCount++] = deviceExtensions[i];
+    }
+    if (surfaceAndDevice->memoryBudgetSupported) {
+        enabledExtensions[enabledExtensionsCount++] = VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+    }
+    createInfo.enabledExtensionCount = enabledExtensionsCount;
+    createInfo.ppEnabledExtensionNames = enabledExtensions;
     if (vkCreateDevice(surfaceAndDevice->physicalDevice, &createInfo, NULL, &surfaceAndDevice->device) != VK_SUCCESS) {
         fprintf(stderr, "ERROR Vulkan: failed to create logical device\n");
     } else {
@@ -513,14 +1313,76 @@ void createGraphicsPipeline(VkDevice device, VkExtent2D *imageExtent, Pipeline *
     fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
     fragShaderStageInfo.module = fragmentShaderModule;
     fragShaderStageInfo.pName = "main";
-    VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
 
+    // Both modules share the constant ids, entries a stage does not use are ignored.
+    VkSpecializationMapEntry specializationEntries[4] = {};
+    specializationEntries[0].constantID = 0;
+    specializationEntries[0].offset = offsetof(ShaderVariant, colorMode);
+    specializationEntries[0].size = sizeof(int32_t);
+    specializationEntries[1].constantID = 1;
+    specializationEntries[1].offset = offsetof(ShaderVariant, lighting);
+    specializationEntries[1].size = sizeof(VkBool32);
+    specializationEntries[2].constantID = 2;
+    specializationEntries[2].offset = offsetof(ShaderVariant, fog);
+    specializationEntries[2].size = sizeof(VkBool32);
+    specializationEntries[3].constantID = 3;
+    specializationEntries[3].offset = offsetof(ShaderVariant, uber);
+    specializationEntries[3].size = sizeof(VkBool32);
+    const uint32_t pipelineCount = SHADER_VARIANT_COUNT + 1;
+    ShaderVariant variants[SHADER_VARIANT_COUNT + 1];
+    VkSpecializationInfo specializationInfos[SHADER_VARIANT_COUNT + 1];
+    VkPipelineShaderStageCreateInfo shaderStages[SHADER_VARIANT_COUNT + 1][2];
+    for (uint32_t i = 0; i < pipelineCount; ++i) {
+        if (i < SHADER_VARIANT_COUNT) {
+            variants[i] = shaderVariants[i];
+        } else {
+            // the uber-shader takes every choice from push constants
+            variants[i] = shaderVariants[0];
+            variants[i].uber = VK_TRUE;
+        }
+        specializationInfos[i].mapEntryCount = 4;
+        specializationInfos[i].pMapEntries = specializationEntries;
+        specializationInfos[i].dataSize = sizeof(ShaderVariant);
+        specializationInfos[i].pData = &variants[i];
+        shaderStages[i][0] = vertShaderStageInfo;
+        shaderStages[i][0].pSpecializationInfo = &specializationInfos[i];
+        shaderStages[i][1] = fragShaderStageInfo;
+        shaderStages[i][1].pSpecializationInfo = &specializationInfos[i];
+    }
+
+    VkVertexInputBindingDescription bindingDescriptions[2] = {};
+    bindingDescriptions[0].binding = 0;
+    bindingDescriptions[0].stride = sizeof(PackedVertex);
+    bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    bindingDescriptions[1].binding = 1;
+    bindingDescriptions[1].stride = sizeof(InstanceData);
+    bindingDescriptions[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+    VkVertexInputAttributeDescription attributeDescriptions[7] = {};
+    attributeDescriptions[0].binding = 0;
+    attributeDescriptions[0].location = 0;
+    attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+    attributeDescriptions[0].offset = offsetof(PackedVertex, position);
+    attributeDescriptions[1].binding = 0;
+    attributeDescriptions[1].location = 1;
+    attributeDescriptions[1].format = VK_FORMAT_R16G16_SNORM;
+    attributeDescriptions[1].offset = offsetof(PackedVertex, normal);
+    attributeDescriptions[2].binding = 0;
+    attributeDescriptions[2].location = 2;
+    attributeDescriptions[2].format = VK_FORMAT_R16G16_SFLOAT;
+    attributeDescriptions[2].offset = offsetof(PackedVertex, uv);
+    // The model-view-projection matrix takes one location per column.
+    for (uint32_t column = 0; column < 4; ++column) {
+        attributeDescriptions[3 + column].binding = 1;
+        attributeDescriptions[3 + column].location = 3 + column;
+        attributeDescriptions[3 + column].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        attributeDescriptions[3 + column].offset = offsetof(InstanceData, modelViewProjection) + 4 * column * sizeof(float);
+    }
     VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
     vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputInfo.vertexBindingDescriptionCount = 0;
-    vertexInputInfo.pVertexBindingDescriptions = NULL;
-    vertexInputInfo.vertexAttributeDescriptionCount = 0;
-    vertexInputInfo.pVertexAttributeDescriptions = NULL;
+    vertexInputInfo.vertexBindingDescriptionCount = 2;
+    vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions;
+    vertexInputInfo.vertexAttributeDescriptionCount = 7;
+    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions;
 
     VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
     inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
@@ -554,7 +1416,7 @@ void createGraphicsPipeline(VkDevice device, VkExtent2D *imageExtent, Pipeline *
     rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
     rasterizer.lineWidth = 1.0f;
     rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-    rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+    rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
     rasterizer.depthBiasEnable = VK_FALSE;
     rasterizer.depthBiasConstantFactor = 0.0f;
     rasterizer.depthBiasClamp = 0.0f;
@@ -569,6 +1431,14 @@ void createGraphicsPipeline(VkDevice device, VkExtent2D *imageExtent, Pipeline *
     multisampling.alphaToCoverageEnable = VK_FALSE;
     multisampling.alphaToOneEnable = VK_FALSE;
 
+    VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencil.depthTestEnable = VK_TRUE;
+    depthStencil.depthWriteEnable = VK_TRUE;
+    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+    depthStencil.depthBoundsTestEnable = VK_FALSE;
+    depthStencil.stencilTestEnable = VK_FALSE;
+
     VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
     colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
     colorBlendAttachment.blendEnable = VK_FALSE;
@@ -593,8 +1463,12 @@ void createGraphicsPipeline(VkDevice device, VkExtent2D *imageExtent, Pipeline *
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     pipelineLayoutInfo.setLayoutCount = 0;
     pipelineLayoutInfo.pSetLayouts = NULL;
-    pipelineLayoutInfo.pushConstantRangeCount = 0;
-    pipelineLayoutInfo.pPushConstantRanges = NULL;
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = offsetof(ShaderVariant, uber);
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
     if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, NULL, &pipeline->pipelineLayout) != VK_SUCCESS) {
         fprintf(stderr, "ERROR Vulkan: failed to create pipeline layout");
     } else {
@@ -604,13 +1478,12 @@ void createGraphicsPipeline(VkDevice device, VkExtent2D *imageExtent, Pipeline *
     VkGraphicsPipelineCreateInfo pipelineInfo = {};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
     pipelineInfo.stageCount = 2;
-    pipelineInfo.pStages = shaderStages;
     pipelineInfo.pVertexInputState = &vertexInputInfo;
     pipelineInfo.pInputAssemblyState = &inputAssembly;
     pipelineInfo.pViewportState = &viewportState;
     pipelineInfo.pRasterizationState = &rasterizer;
     pipelineInfo.pMultisampleState = &multisampling;
-    pipelineInfo.pDepthStencilState = NULL;
+    pipelineInfo.pDepthStencilState = &depthStencil;
     pipelineInfo.pColorBlendState = &colorBlending;
     pipelineInfo.pDynamicState = NULL;
     pipelineInfo.layout = pipeline->pipelineLayout;
@@ -618,11 +1491,20 @@ void createGraphicsPipeline(VkDevice device, VkExtent2D *imageExtent, Pipeline *
     pipelineInfo.subpass = 0;
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
     pipelineInfo.basePipelineIndex = -1;
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &pipeline->pipeline) != VK_SUCCESS) {
-        fprintf(stderr, "ERROR Vulkan: failed to create graphics pipeline\n");
+    VkGraphicsPipelineCreateInfo pipelineInfos[SHADER_VARIANT_COUNT + 1];
+    VkPipeline pipelines[SHADER_VARIANT_COUNT + 1];
+    for (uint32_t i = 0; i < pipelineCount; ++i) {
+        pipelineInfos[i] = pipelineInfo;
+        pipelineInfos[i].pStages = shaderStages[i];
+    }
+    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, pipelineCount, pipelineInfos, NULL, pipelines) != VK_SUCCESS) {
+        fprintf(stderr, "ERROR Vulkan: failed to create graphics pipelines\n");
     } else {
-        printf("INFO Vulkan: created graphics pipeline\n");
+        printf("INFO Vulkan: created %u specialized graphics pipelines and the uber-shader pipeline\n", SHADER_VARIANT_COUNT);
     }
+    memcpy(pipeline->specialized, pipelines, sizeof(pipeline->specialized));
+    pipeline->uber = pipelines[SHADER_VARIANT_COUNT];
+    selectShaderVariant(pipeline, 0, false);
 
     vkDestroyShaderModule(device, vertexShaderModule, NULL);
     vkDestroyShaderModule(device, fragmentShaderModule, NULL);
@@ -630,7 +1512,7 @@ void createGraphicsPipeline(VkDevice device, VkExtent2D *imageExtent, Pipeline *
     free(fragmentShader);
 }
 
-void createRenderPass(VkDevice device, VkFormat imageFormat, VkRenderPass *renderPass) {
+void createRenderPass(VkDevice device, VkFormat imageFormat, VkFormat depthFormat, VkRenderPass *renderPass) {
     VkAttachmentDescription colorAttachment = {};
     colorAttachment.format = imageFormat;
     colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
@@ -640,24 +1522,38 @@ void createRenderPass(VkDevice device, VkFormat imageFormat, VkRenderPass *rende
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    VkAttachmentDescription depthAttachment = {};
+    depthAttachment.format = depthFormat;
+    depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    VkAttachmentDescription attachments[] = {colorAttachment, depthAttachment};
     VkAttachmentReference colorAttachmentRef = {};
     colorAttachmentRef.attachment = 0;
     colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    VkAttachmentReference depthAttachmentRef = {};
+    depthAttachmentRef.attachment = 1;
+    depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
     VkSubpassDescription subpass = {};
     subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
     subpass.colorAttachmentCount = 1;
     subpass.pColorAttachments = &colorAttachmentRef;
+    subpass.pDepthStencilAttachment = &depthAttachmentRef;
     VkSubpassDependency dependency = {};
     dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
     dependency.dstSubpass = 0;
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
     dependency.srcAccessMask = 0;
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
     VkRenderPassCreateInfo renderPassInfo = {};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    renderPassInfo.attachmentCount = 1;
-    renderPassInfo.pAttachments = &colorAttachment;
+    renderPassInfo.attachmentCount = 2;
+    renderPassInfo.pAttachments = attachments;
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
     renderPassInfo.dependencyCount = 1;
@@ -673,12 +1569,13 @@ void createFramebuffers(VkDevice device, SwapchainAndViews *swapchainAndViews, P
     buffers->framebuffers = (VkFramebuffer *) malloc(swapchainAndViews->imageCount * sizeof(VkFramebuffer));
     for (uint32_t i = 0; i < swapchainAndViews->imageCount; ++i) {
         VkImageView attachments[] = {
-            swapchainAndViews->imageViews[i]
+            swapchainAndViews->imageViews[i],
+            swapchainAndViews->depthImageView
         };
         VkFramebufferCreateInfo framebufferInfo = {};
         framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
         framebufferInfo.renderPass = pipeline->renderPass;
-        framebufferInfo.attachmentCount = 1;
+        framebufferInfo.attachmentCount = 2;
         framebufferInfo.pAttachments = attachments;
         framebufferInfo.width = swapchainAndViews->imageExtent.width;
         framebufferInfo.height = swapchainAndViews->imageExtent.height;
@@ -689,19 +1586,118 @@ void createFramebuffers(VkDevice device, SwapchainAndViews *swapchainAndViews, P
     }
 }
 
+uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties) {
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i) {
+        if ((typeFilter & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+            return i;
+        }
+    }
+    fprintf(stderr, "ERROR Vulkan: failed to find suitable memory type\n");
+    return 0;
+}
+
+VkFormat findDepthFormat(VkPhysicalDevice physicalDevice) {
+    const VkFormat candidates[] = {VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D16_UNORM};
+    for (uint32_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); ++i) {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, candidates[i], &properties);
+        if (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+            return candidates[i];
+        }
+    }
+    fprintf(stderr, "ERROR Vulkan: failed to find supported depth format\n");
+    return VK_FORMAT_D16_UNORM;
+}
+
+void createDepthResources(SurfaceAndDevice *surfaceAndDevice, SwapchainAndViews *swapchainAndViews) {
+    VkDevice device = surfaceAndDevice->device;
+    swapchainAndViews->depthFormat = findDepthFormat(surfaceAndDevice->physicalDevice);
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent.width = swapchainAndViews->imageExtent.width;
+    imageInfo.extent.height = swapchainAndViews->imageExtent.height;
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = swapchainAndViews->depthFormat;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (vkCreateImage(device, &imageInfo, NULL, &swapchainAndViews->depthImage) != VK_SUCCESS) {
+        fprintf(stderr, "ERROR Vulkan: failed to create depth image\n");
+    }
+    VkMemoryRequirements memoryRequirements;
+    vkGetImageMemoryRequirements(device, swapchainAndViews->depthImage, &memoryRequirements);
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = memoryRequirements.size;
+    allocInfo.memoryTypeIndex = findMemoryType(surfaceAndDevice->physicalDevice, memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    if (allocateTrackedMemory(&surfaceAndDevice->memoryTracker, device, &allocInfo, MEMORY_CATEGORY_IMAGE, &swapchainAndViews->depthImageMemory) != VK_SUCCESS) {
+        fprintf(stderr, "ERROR Vulkan: failed to allocate depth image memory\n");
+    }
+    vkBindImageMemory(device, swapchainAndViews->depthImage, swapchainAndViews->depthImageMemory, 0);
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = swapchainAndViews->depthImage;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = swapchainAndViews->depthFormat;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+    if (vkCreateImageView(device, &viewInfo, NULL, &swapchainAndViews->depthImageView) != VK_SUCCESS) {
+        fprintf(stderr, "ERROR Vulkan: failed to create depth image view\n");
+    } else {
+        printf("INFO Vulkan: created depth buffer\n");
+    }
+}
+
+/* Without a window the device is created headless, with surface set to VK_NULL_HANDLE. */
 void createSurfaceAndDevice(GLFWwindow *window, SurfaceAndDevice *surfaceAndDevice) {
-    createInstance(surfaceAndDevice);
-    createSurface(window, surfaceAndDevice);
+    createInstance(surfaceAndDevice, window == NULL);
+    surfaceAndDevice->surface = VK_NULL_HANDLE;
+    if (window != NULL) {
+        createSurface(window, surfaceAndDevice);
+    }
     pickPhysicalDevice(surfaceAndDevice);
     createLogicalDevice(surfaceAndDevice);
+    createMemoryTracker(surfaceAndDevice->physicalDevice, surfaceAndDevice->memoryBudgetSupported, &surfaceAndDevice->memoryTracker);
+    setMemoryPressureCallback(&surfaceAndDevice->memoryTracker, MEMORY_PRESSURE_THRESHOLD, memory_pressure_callback, NULL);
 }
 
 void destroySurfaceAndDevice(SurfaceAndDevice *surfaceAndDevice) {
+    destroyMemoryTracker(&surfaceAndDevice->memoryTracker);
     vkDestroyDevice(surfaceAndDevice->device, NULL);
-    vkDestroySurfaceKHR(surfaceAndDevice->instance, surfaceAndDevice->surface, NULL);
+    if (surfaceAndDevice->surface != VK_NULL_HANDLE) {
+        vkDestroySurfaceKHR(surfaceAndDevice->instance, surfaceAndDevice->surface, NULL);
+    }
     vkDestroyInstance(surfaceAndDevice->instance, NULL);
 }
 
+/* Bytes per pixel of the color formats a surface may offer, 4 for anything else. */
+uint32_t formatBytesPerPixel(VkFormat format) {
+    switch (format) {
+        case VK_FORMAT_R5G6B5_UNORM_PACK16:
+        case VK_FORMAT_B5G6R5_UNORM_PACK16:
+        case VK_FORMAT_A1R5G5B5_UNORM_PACK16:
+            return 2;
+        case VK_FORMAT_R16G16B16A16_UNORM:
+        case VK_FORMAT_R16G16B16A16_SFLOAT:
+            return 8;
+        case VK_FORMAT_R32G32B32A32_SFLOAT:
+            return 16;
+        default:
+            // 8 bit RGBA and BGRA, and the packed 10 bit formats
+            return 4;
+    }
+}
+
 void createSwapchainAndViews(SurfaceAndDevice *surfaceAndDevice, SwapchainAndViews *swapchainAndViews) {
     VkSwapchainCreateInfoKHR swapchainCreateInfo;
     createSwapchain(surfaceAndDevice, swapchainAndViews);
@@ -709,22 +1705,34 @@ void createSwapchainAndViews(SurfaceAndDevice *surfaceAndDevice, SwapchainAndVie
     swapchainAndViews->images = (VkImage *) malloc(swapchainAndViews->imageCount * sizeof(VkImage));
     vkGetSwapchainImagesKHR(surfaceAndDevice->device, swapchainAndViews->swapchain, &swapchainAndViews->imageCount, swapchainAndViews->images);
     createImageViews(surfaceAndDevice->device, swapchainAndViews);
+    createDepthResources(surfaceAndDevice, swapchainAndViews);
+    setSwapchainMemoryEstimate(&surfaceAndDevice->memoryTracker, (VkDeviceSize) swapchainAndViews->imageCount
+                               * swapchainAndViews->imageExtent.width * swapchainAndViews->imageExtent.height
+                               * formatBytesPerPixel(swapchainAndViews->format));
 }
 
-void destroySwapchainAndViews(VkDevice device, SwapchainAndViews *swapchainAndViews) {
+void destroySwapchainAndViews(SurfaceAndDevice *surfaceAndDevice, SwapchainAndViews *swapchainAndViews) {
+    VkDevice device = surfaceAndDevice->device;
+    vkDestroyImageView(device, swapchainAndViews->depthImageView, NULL);
+    vkDestroyImage(device, swapchainAndViews->depthImage, NULL);
+    freeTrackedMemory(&surfaceAndDevice->memoryTracker, device, swapchainAndViews->depthImageMemory);
+    setSwapchainMemoryEstimate(&surfaceAndDevice->memoryTracker, 0);
     destroyImageViews(device, swapchainAndViews);
     free(swapchainAndViews->images);
     vkDestroySwapchainKHR(device, swapchainAndViews->swapchain, NULL);
 }
 
 void createPipeline(VkDevice device, SwapchainAndViews *swapchainAndViews, Pipeline *pipeline) {
-    createRenderPass(device, swapchainAndViews->format, &pipeline->renderPass);
+    createRenderPass(device, swapchainAndViews->format, swapchainAndViews->depthFormat, &pipeline->renderPass);
     createGraphicsPipeline(device, &swapchainAndViews->imageExtent, pipeline);
 }
 
 void destroyPipeline(VkDevice device, Pipeline *pipeline) {
     vkDestroyPipelineLayout(device, pipeline->pipelineLayout, NULL);
-    vkDestroyPipeline(device, pipeline->pipeline, NULL);
+    for (uint32_t i = 0; i < SHADER_VARIANT_COUNT; ++i) {
+        vkDestroyPipeline(device, pipeline->specialized[i], NULL);
+    }
+    vkDestroyPipeline(device, pipeline->uber, NULL);
     vkDestroyRenderPass(device, pipeline->renderPass, NULL);
 }
 
@@ -732,7 +1740,7 @@ void createCommandPool(SurfaceAndDevice *surfaceAndDevice, Buffers *buffers) {
     VkCommandPoolCreateInfo poolInfo = {};
     poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     poolInfo.queueFamilyIndex = surfaceAndDevice->queueIndex;
-    poolInfo.flags = 0;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
     if (vkCreateCommandPool(surfaceAndDevice->device, &poolInfo, NULL, &buffers->commandPool) != VK_SUCCESS) {
         fprintf(stderr, "ERROR Vulkan: failed to create command pool\n");
     } else {
@@ -740,7 +1748,109 @@ void createCommandPool(SurfaceAndDevice *surfaceAndDevice, Buffers *buffers) {
     }
 }
 
-void createCommandBuffers(VkDevice device, SwapchainAndViews *swapchainAndViews, Pipeline *pipeline, Buffers *buffers) {
+void createBuffer(SurfaceAndDevice *surfaceAndDevice, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, MemoryCategory category, VkBuffer *buffer, VkDeviceMemory *bufferMemory) {
+    VkDevice device = surfaceAndDevice->device;
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (vkCreateBuffer(device, &bufferInfo, NULL, buffer) != VK_SUCCESS) {
+        fprintf(stderr, "ERROR Vulkan: failed to create buffer\n");
+    }
+    VkMemoryRequirements memoryRequirements;
+    vkGetBufferMemoryRequirements(device, *buffer, &memoryRequirements);
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = memoryRequirements.size;
+    allocInfo.memoryTypeIndex = findMemoryType(surfaceAndDevice->physicalDevice, memoryRequirements.memoryTypeBits, properties);
+    if (allocateTrackedMemory(&surfaceAndDevice->memoryTracker, device, &allocInfo, category, bufferMemory) != VK_SUCCESS) {
+        fprintf(stderr, "ERROR Vulkan: failed to allocate buffer memory\n");
+    }
+    vkBindBufferMemory(device, *buffer, *bufferMemory, 0);
+}
+
+void copyBuffer(SurfaceAndDevice *surfaceAndDevice, VkCommandPool commandPool, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize srcOffset, VkDeviceSize size) {
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = commandPool;
+    allocInfo.commandBufferCount = 1;
+    VkCommandBuffer commandBuffer;
+    vkAllocateCommandBuffers(surfaceAndDevice->device, &allocInfo, &commandBuffer);
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    VkBufferCopy copyRegion = {};
+    copyRegion.srcOffset = srcOffset;
+    copyRegion.dstOffset = 0;
+    copyRegion.size = size;
+    vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+    vkEndCommandBuffer(commandBuffer);
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    vkQueueSubmit(surfaceAndDevice->queue, 1, &submitInfo, VK_NULL_HANDLE);
+    vkQueueWaitIdle(surfaceAndDevice->queue);
+    vkFreeCommandBuffers(surfaceAndDevice->device, commandPool, 1, &commandBuffer);
+}
+
+void createMeshBuffers(SurfaceAndDevice *surfaceAndDevice, VkCommandPool commandPool, const char meshFilename[], MeshBuffers *meshBuffers) {
+    VkDevice device = surfaceAndDevice->device;
+    if (!mapMeshFile(meshFilename, &meshBuffers->mapped)) {
+        exit(EXIT_FAILURE);
+    }
+    const MeshFileHeader *header = meshBuffers->mapped.header;
+    VkDeviceSize vertexSize = (VkDeviceSize) header->vertexCount * header->vertexStride;
+    VkDeviceSize indexSize = (VkDeviceSize) header->indexCount * header->indexSize;
+    meshBuffers->indexCount = header->indexCount;
+    meshBuffers->indexType = header->indexSize == 2 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+    meshBuffers->lods = header->lods;
+    meshBuffers->lodCount = header->lodCount;
+    float radiusSquared = 0.0f;
+    for (uint32_t k = 0; k < 3; ++k) {
+        float extent = header->boundsMax[k] - header->boundsMin[k];
+        meshBuffers->center[k] = 0.5f * (header->boundsMin[k] + header->boundsMax[k]);
+        radiusSquared += 0.25f * extent * extent;
+    }
+    meshBuffers->radius = sqrtf(radiusSquared);
+
+    // The mapped file is the only CPU-side copy, it goes straight into the staging buffer.
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingBufferMemory;
+    createBuffer(surfaceAndDevice, vertexSize + indexSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 MEMORY_CATEGORY_STAGING, &stagingBuffer, &stagingBufferMemory);
+    void *data;
+    vkMapMemory(device, stagingBufferMemory, 0, vertexSize + indexSize, 0, &data);
+    memcpy(data, meshBuffers->mapped.vertices, (size_t) vertexSize);
+    memcpy((char *) data + vertexSize, meshBuffers->mapped.indices, (size_t) indexSize);
+    vkUnmapMemory(device, stagingBufferMemory);
+
+    createBuffer(surfaceAndDevice, vertexSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MEMORY_CATEGORY_BUFFER, &meshBuffers->vertexBuffer, &meshBuffers->vertexBufferMemory);
+    createBuffer(surfaceAndDevice, indexSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MEMORY_CATEGORY_BUFFER, &meshBuffers->indexBuffer, &meshBuffers->indexBufferMemory);
+    copyBuffer(surfaceAndDevice, commandPool, stagingBuffer, meshBuffers->vertexBuffer, 0, vertexSize);
+    copyBuffer(surfaceAndDevice, commandPool, stagingBuffer, meshBuffers->indexBuffer, vertexSize, indexSize);
+    vkDestroyBuffer(device, stagingBuffer, NULL);
+    freeTrackedMemory(&surfaceAndDevice->memoryTracker, device, stagingBufferMemory);
+    printf("INFO Vulkan: created mesh buffers for %s (%u vertices, %u triangles, %u LODs)\n",
+           meshFilename, header->vertexCount, header->lods[0].indexCount / 3, header->lodCount);
+}
+
+void destroyMeshBuffers(SurfaceAndDevice *surfaceAndDevice, MeshBuffers *meshBuffers) {
+    VkDevice device = surfaceAndDevice->device;
+    vkDestroyBuffer(device, meshBuffers->indexBuffer, NULL);
+    freeTrackedMemory(&surfaceAndDevice->memoryTracker, device, meshBuffers->indexBufferMemory);
+    vkDestroyBuffer(device, meshBuffers->vertexBuffer, NULL);
+    freeTrackedMemory(&surfaceAndDevice->memoryTracker, device, meshBuffers->vertexBufferMemory);
+    unmapMeshFile(&meshBuffers->mapped);
+}
+
+void createCommandBuffers(VkDevice device, SwapchainAndViews *swapchainAndViews, Buffers *buffers) {
     buffers->commandBuffers = (VkCommandBuffer *) malloc(swapchainAndViews->imageCount * sizeof(VkCommandBuffer));
     VkCommandBufferAllocateInfo allocInfo = {};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -752,33 +1862,6 @@ void createCommandBuffers(VkDevice device, SwapchainAndViews *swapchainAndViews,
     } else {
         printf("INFO Vulkan: created command buffers\n");
     }
-
-    for (size_t i = 0; i < swapchainAndViews->imageCount; ++i) {
-        VkCommandBufferBeginInfo beginInfo = {};
-        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        beginInfo.flags = 0;
-        beginInfo.pInheritanceInfo = NULL;
-        if (vkBeginCommandBuffer(buffers->commandBuffers[i], &beginInfo) != VK_SUCCESS) {
-            fprintf(stderr, "ERROR Vulkan: failed to begin recording command buffer\n");
-        }
-        VkRenderPassBeginInfo renderPassInfo = {};
-        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        renderPassInfo.renderPass = pipeline->renderPass;
-        renderPassInfo.framebuffer = buffers->framebuffers[i];
-        renderPassInfo.renderArea.offset.x = 0;
-        renderPassInfo.renderArea.offset.y = 0;
-        renderPassInfo.renderArea.extent = swapchainAndViews->imageExtent;
-        VkClearValue clearColor = {0.0f, 0.0f, 0.0f, 1.0f};
-        renderPassInfo.clearValueCount = 1;
-        renderPassInfo.pClearValues = &clearColor;
-        vkCmdBeginRenderPass(buffers->commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-            vkCmdBindPipeline(buffers->commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipeline);
-            vkCmdDraw(buffers->commandBuffers[i], 3, 1, 0, 0);
-        vkCmdEndRenderPass(buffers->commandBuffers[i]);
-        if (vkEndCommandBuffer(buffers->commandBuffers[i]) != VK_SUCCESS) {
-            fprintf(stderr, "ERROR Vulkan: failed to record command buffer\n");
-        }
-    }
 }
 
 void createSemaphores(VkDevice device, Buffers *buffers) {
@@ -792,14 +1875,41 @@ void createSemaphores(VkDevice device, Buffers *buffers) {
     }
 }
 
-void createBuffers(SurfaceAndDevice *surfaceAndDevice, SwapchainAndViews *swapchainAndViews, Pipeline *pipeline, Buffers *buffers) {
+/* Two timestamps around the render pass of every frame. */
+void createTimestampQueries(SurfaceAndDevice *surfaceAndDevice, Buffers *buffers) {
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(surfaceAndDevice->physicalDevice, &deviceProperties);
+    buffers->timestampQueryPool = VK_NULL_HANDLE;
+    buffers->timestampPeriod = deviceProperties.limits.timestampPeriod;
+    if (!deviceProperties.limits.timestampComputeAndGraphics) {
+        printf("INFO Vulkan: GPU timestamps not supported\n");
+        return;
+    }
+    VkQueryPoolCreateInfo queryPoolInfo = {};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolInfo.queryCount = 2;
+    if (vkCreateQueryPool(surfaceAndDevice->device, &queryPoolInfo, NULL, &buffers->timestampQueryPool) != VK_SUCCESS) {
+        fprintf(stderr, "ERROR Vulkan: failed to create timestamp query pool\n");
+        buffers->timestampQueryPool = VK_NULL_HANDLE;
+    } else {
+        printf("INFO Vulkan: created timestamp query pool\n");
+    }
+}
+
+void createBuffers(SurfaceAndDevice *surfaceAndDevice, SwapchainAndViews *swapchainAndViews, Pipeline *pipeline, Buffers *buffers, const char meshFilename[], MeshBuffers *meshBuffers) {
     createFramebuffers(surfaceAndDevice->device, swapchainAndViews, pipeline, buffers);
     createCommandPool(surfaceAndDevice, buffers);
-    createCommandBuffers(surfaceAndDevice->device, swapchainAndViews, pipeline, buffers);
+    createMeshBuffers(surfaceAndDevice, buffers->commandPool, meshFilename, meshBuffers);
+    createCommandBuffers(surfaceAndDevice->device, swapchainAndViews, buffers);
     createSemaphores(surfaceAndDevice->device, buffers);
+    createTimestampQueries(surfaceAndDevice, buffers);
 }
 
 void destroyBuffers(VkDevice device, uint32_t imageCount, Buffers *buffers) {
+    if (buffers->timestampQueryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, buffers->timestampQueryPool, NULL);
+    }
     vkDestroySemaphore(device, buffers->renderFinishedSemaphore, NULL);
     vkDestroySemaphore(device, buffers->imageAvailableSemaphore, NULL);
     free(buffers->commandBuffers);
@@ -810,18 +1920,553 @@ void destroyBuffers(VkDevice device, uint32_t imageCount, Buffers *buffers) {
     free(buffers->framebuffers);
 }
 
-void initVulkan(GLFWwindow *window, SurfaceAndDevice *surfaceAndDevice, SwapchainAndViews *swapchainAndViews, Pipeline *pipeline, Buffers *buffers) {
-    createSurfaceAndDevice(window, surfaceAndDevice);
-    createSwapchainAndViews(surfaceAndDevice, swapchainAndViews);
-    createPipeline(surfaceAndDevice->device, swapchainAndViews, pipeline);
-    createBuffers(surfaceAndDevice, swapchainAndViews, pipeline, buffers);
+/* A grid of instances on the ground plane, viewed at a shallow angle so that their distances
+ * to the camera, and with it the selected LODs, cover a wide range. */
+void createScene(VkExtent2D *imageExtent, MeshBuffers *meshBuffers, Scene *scene) {
+    uint32_t count = GRID_SIZE * GRID_SIZE;
+    if (!createTransformInstances(count, &scene->transforms)) {
+        fprintf(stderr, "ERROR scene: failed to allocate instance transforms\n");
+        exit(EXIT_FAILURE);
+    }
+    scene->instances.count = count;
+    scene->instances.centerX = scene->transforms.positionX;
+    scene->instances.centerY = scene->transforms.positionY;
+    scene->instances.centerZ = scene->transforms.positionZ;
+    scene->instances.scale = scene->transforms.scale;
+    scene->instances.radius = (float *) malloc(count * sizeof(float));
+    scene->selectedLods = (uint8_t *) calloc(count, sizeof(uint8_t));
+    scene->visibleInstances = (uint32_t *) malloc(count * sizeof(uint32_t));
+    scene->visibleCount = 0;
+    scene->lodEnabled = true;
+    float scale = 1.0f / (meshBuffers->radius > 0.0f ? meshBuffers->radius : 1.0f);
+    for (uint32_t z = 0; z < GRID_SIZE; ++z) {
+        for (uint32_t x = 0; x < GRID_SIZE; ++x) {
+            uint32_t i = z * GRID_SIZE + x;
+            scene->transforms.positionX[i] = ((float) x - 0.5f * (GRID_SIZE - 1)) * GRID_SPACING;
+            scene->transforms.positionY[i] = 1.0f;
+            scene->transforms.positionZ[i] = (float) z * GRID_SPACING;
+            scene->transforms.scale[i] = scale;
+            scene->instances.radius[i] = meshBuffers->radius * scale;
+            // start every instance at a different angle around y
+            float angle = 0.5f * (float) i;
+            scene->transforms.rotationY[i] = sinf(angle);
+            scene->transforms.rotationW[i] = cosf(angle);
+        }
+    }
+    scene->animate = true;
+    scene->lastUpdate = glfwGetTime();
+    if (!createFrameArena(FRAME_ARENA_SIZE, &scene->arena)) {
+        fprintf(stderr, "ERROR scene: failed to allocate frame arena\n");
+        exit(EXIT_FAILURE);
+    }
+    scene->isa = transformBestIsa();
+
+    float eye[3] = {0.0f, 6.0f, -12.0f};
+    float center[3] = {0.0f, 0.0f, 0.5f * GRID_SIZE * GRID_SPACING};
+    float up[3] = {0.0f, 1.0f, 0.0f};
+    float view[16], projection[16];
+    float aspect = (float) imageExtent->width / (float) imageExtent->height;
+    mat4LookAt(eye, center, up, view);
+    mat4Perspective(FIELD_OF_VIEW, aspect, NEAR_PLANE, FAR_PLANE, projection);
+    mat4Multiply(projection, view, scene->batch.viewProjection);
+    transformExtractFrustum(scene->batch.viewProjection, scene->batch.frustum);
+    memcpy(scene->batch.pivot, meshBuffers->center, sizeof(scene->batch.pivot));
+    scene->batch.boundingRadius = meshBuffers->radius;
+    memcpy(scene->camera.position, eye, sizeof(eye));
+    scene->camera.projectionScale = imageExtent->height / (2.0f * tanf(FIELD_OF_VIEW / 2.0f));
+    scene->camera.threshold = LOD_THRESHOLD_PIXELS;
+    printf("INFO scene: %u instances, %s transform kernels, press L to toggle LOD selection, "
+           "M to cycle shading, U to toggle the uber-shader, B to benchmark shader variants, "
+           "D to benchmark draw list recording, P to pause the animation, I to toggle on-demand rendering\n",
+           count, transformIsaNames[scene->isa]);
+}
+
+void destroyScene(Scene *scene) {
+    destroyFrameArena(&scene->arena);
+    free(scene->visibleInstances);
+    free(scene->selectedLods);
+    free(scene->instances.radius);
+    destroyTransformInstances(&scene->transforms);
+}
+
+/* Host visible and persistently mapped, the transform kernels write straight into it. */
+void createInstanceBuffer(SurfaceAndDevice *surfaceAndDevice, Scene *scene) {
+    VkDeviceSize size = (VkDeviceSize) scene->transforms.count * sizeof(InstanceData);
+    createBuffer(surfaceAndDevice, size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 MEMORY_CATEGORY_BUFFER, &scene->instanceBuffer, &scene->instanceBufferMemory);
+    if (vkMapMemory(surfaceAndDevice->device, scene->instanceBufferMemory, 0, size, 0, (void **) &scene->instanceData) != VK_SUCCESS) {
+        fprintf(stderr, "ERROR Vulkan: failed to map instance buffer\n");
+    } else {
+        printf("INFO Vulkan: created instance buffer\n");
+    }
+}
+
+void destroyInstanceBuffer(SurfaceAndDevice *surfaceAndDevice, Scene *scene) {
+    vkUnmapMemory(surfaceAndDevice->device, scene->instanceBufferMemory);
+    vkDestroyBuffer(surfaceAndDevice->device, scene->instanceBuffer, NULL);
+    freeTrackedMemory(&surfaceAndDevice->memoryTracker, surfaceAndDevice->device, scene->instanceBufferMemory);
+}
+
+void createParticleBuffers(SurfaceAndDevice *surfaceAndDevice, ParticleSystem *particles) {
+    VkDeviceSize count = particles->maxParticles;
+    VkDeviceSize sizes[PARTICLE_BUFFER_COUNT] = {};
+    sizes[PARTICLE_BUFFER_POSITIONS] = count * 4 * sizeof(float);
+    sizes[PARTICLE_BUFFER_VELOCITIES] = count * 4 * sizeof(float);
+    sizes[PARTICLE_BUFFER_ALIVE] = 2 * count * sizeof(uint32_t);
+    sizes[PARTICLE_BUFFER_DEAD] = count * sizeof(uint32_t);
+    sizes[PARTICLE_BUFFER_STATE] = sizeof(ParticleState);
+    for (uint32_t i = 0; i < PARTICLE_BUFFER_COUNT; ++i) {
+        VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+        if (i == PARTICLE_BUFFER_STATE) {
+            usage |= VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        }
+        createBuffer(surfaceAndDevice, sizes[i], usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MEMORY_CATEGORY_BUFFER,
+                     &particles->buffers[i], &particles->bufferMemory[i]);
+    }
+}
+
+/* One set with every particle buffer, binding i is buffer i. */
+void createParticleDescriptors(VkDevice device, ParticleSystem *particles) {
+    VkDescriptorSetLayoutBinding bindings[PARTICLE_BUFFER_COUNT] = {};
+    for (uint32_t i = 0; i < PARTICLE_BUFFER_COUNT; ++i) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT;
+        bindings[i].pImmutableSamplers = NULL;
+    }
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = PARTICLE_BUFFER_COUNT;
+    layoutInfo.pBindings = bindings;
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, NULL, &particles->descriptorSetLayout) != VK_SUCCESS) {
+        fprintf(stderr, "ERROR Vulkan: failed to create particle descriptor set layout\n");
+    }
+    VkDescriptorPoolSize poolSize = {};
+    poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSize.descriptorCount = PARTICLE_BUFFER_COUNT;
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.maxSets = 1;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    if (vkCreateDescriptorPool(device, &poolInfo, NULL, &particles->descriptorPool) != VK_SUCCESS) {
+        fprintf(stderr, "ERROR Vulkan: failed to create particle descriptor pool\n");
+    }
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = particles->descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &particles->descriptorSetLayout;
+    if (vkAllocateDescriptorSets(device, &allocInfo, &particles->descriptorSet) != VK_SUCCESS) {
+        fprintf(stderr, "ERROR Vulkan: failed to allocate particle descriptor set\n");
+    }
+    VkDescriptorBufferInfo bufferInfos[PARTICLE_BUFFER_COUNT] = {};
+    VkWriteDescriptorSet writes[PARTICLE_BUFFER_COUNT] = {};
+    for (uint32_t i = 0; i < PARTICLE_BUFFER_COUNT; ++i) {
+        bufferInfos[i].buffer = particles->buffers[i];
+        bufferInfos[i].offset = 0;
+        bufferInfos[i].range = VK_WHOLE_SIZE;
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = particles->descriptorSet;
+        writes[i].dstBinding = i;
+        writes[i].dstArrayElement = 0;
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[i].pBufferInfo = &bufferInfos[i];
+    }
+    vkUpdateDescriptorSets(device, PARTICLE_BUFFER_COUNT, writes, 0, NULL);
+}
+
+VkShaderModule loadShaderModule(VkDevice device, const char filename[]) {
+    uint32_t *shader;
+    size_t shaderSize = readShaderFromFile(filename, &shader);
+    VkShaderModule shaderModule = createShaderModule(device, shader, shaderSize);
+    free(shader);
+    return shaderModule;
+}
+
+/* Points without vertex input, every vertex fetches its particle from the storage buffers.
+ * They are depth tested against the scene but do not write depth. */
+void createParticleRenderPipeline(VkDevice device, VkRenderPass renderPass, const VkExtent2D *imageExtent, ParticleSystem *particles) {
+    VkPipelineShaderStageCreateInfo shaderStages[2] = {};
+    shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    shaderStages[0].module = loadShaderModule(device, "shaders/particle_vert.spv");
+    shaderStages[0].pName = "main";
+    shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    shaderStages[1].module = loadShaderModule(device, "shaders/particle_frag.spv");
+    shaderStages[1].pName = "main";
+
+    VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertexInputInfo.vertexBindingDescriptionCount = 0;
+    vertexInputInfo.vertexAttributeDescriptionCount = 0;
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+    inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+    VkViewport viewport = {};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = (float) imageExtent->width;
+    viewport.height = (float) imageExtent->height;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    VkRect2D scissor = {};
+    scissor.offset.x = 0;
+    scissor.offset.y = 0;
+    scissor.extent = *imageExtent;
+    VkPipelineViewportStateCreateInfo viewportState = {};
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.viewportCount = 1;
+    viewportState.pViewports = &viewport;
+    viewportState.scissorCount = 1;
+    viewportState.pScissors = &scissor;
+
+    VkPipelineRasterizationStateCreateInfo rasterizer = {};
+    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizer.depthClampEnable = VK_FALSE;
+    rasterizer.rasterizerDiscardEnable = VK_FALSE;
+    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizer.lineWidth = 1.0f;
+    rasterizer.cullMode = VK_CULL_MODE_NONE;
+    rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    rasterizer.depthBiasEnable = VK_FALSE;
+
+    VkPipelineMultisampleStateCreateInfo multisampling = {};
+    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampling.sampleShadingEnable = VK_FALSE;
+    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    multisampling.minSampleShading = 1.0f;
+
+    VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencil.depthTestEnable = VK_TRUE;
+    depthStencil.depthWriteEnable = VK_FALSE;
+    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+    depthStencil.depthBoundsTestEnable = VK_FALSE;
+    depthStencil.stencilTestEnable = VK_FALSE;
+
+    VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    colorBlendAttachment.blendEnable = VK_FALSE;
+    VkPipelineColorBlendStateCreateInfo colorBlending = {};
+    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlending.logicOpEnable = VK_FALSE;
+    colorBlending.attachmentCount = 1;
+    colorBlending.pAttachments = &colorBlendAttachment;
+
+    VkGraphicsPipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.stageCount = 2;
+    pipelineInfo.pStages = shaderStages;
+    pipelineInfo.pVertexInputState = &vertexInputInfo;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &rasterizer;
+    pipelineInfo.pMultisampleState = &multisampling;
+    pipelineInfo.pDepthStencilState = &depthStencil;
+    pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.pDynamicState = NULL;
+    pipelineInfo.layout = particles->pipelineLayout;
+    pipelineInfo.renderPass = renderPass;
+    pipelineInfo.subpass = 0;
+    pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+    pipelineInfo.basePipelineIndex = -1;
+    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &particles->render) != VK_SUCCESS) {
+        fprintf(stderr, "ERROR Vulkan: failed to create particle graphics pipeline\n");
+    }
+    vkDestroyShaderModule(device, shaderStages[0].module, NULL);
+    vkDestroyShaderModule(device, shaderStages[1].module, NULL);
+}
+
+/* Every pass shares one layout, so the descriptor set and push constants stay bound from
+ * the first compute pass to the draw. Without a render pass only the compute pipelines are
+ * created. */
+void createParticlePipelines(VkDevice device, VkRenderPass renderPass, const VkExtent2D *imageExtent, ParticleSystem *particles) {
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(ParticleParams);
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &particles->descriptorSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, NULL, &particles->pipelineLayout) != VK_SUCCESS) {
+        fprintf(stderr, "ERROR Vulkan: failed to create particle pipeline layout\n");
+    }
+
+    const char *const shaderFiles[PARTICLE_PASS_COUNT] = {
+        "shaders/particle_init.spv",
+        "shaders/particle_emit.spv",
+        "shaders/particle_args.spv",
+        "shaders/particle_simulate.spv",
+        "shaders/particle_args.spv"
+    };
+    // constant 0 is FINISH in particle_args.comp, the other shaders ignore it
+    const VkBool32 finish[PARTICLE_PASS_COUNT] = {VK_FALSE, VK_FALSE, VK_FALSE, VK_FALSE, VK_TRUE};
+    VkSpecializationMapEntry specializationEntry = {};
+    specializationEntry.constantID = 0;
+    specializationEntry.offset = 0;
+    specializationEntry.size = sizeof(VkBool32);
+    VkSpecializationInfo specializationInfos[PARTICLE_PASS_COUNT];
+    VkComputePipelineCreateInfo pipelineInfos[PARTICLE_PASS_COUNT] = {};
+    for (uint32_t i = 0; i < PARTICLE_PASS_COUNT; ++i) {
+        specializationInfos[i].mapEntryCount = 1;
+        specializationInfos[i].pMapEntries = &specializationEntry;
+        specializationInfos[i].dataSize = sizeof(VkBool32);
+        specializationInfos[i].pData = &finish[i];
+        pipelineInfos[i].sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfos[i].stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineInfos[i].stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineInfos[i].stage.module = loadShaderModule(device, shaderFiles[i]);
+        pipelineInfos[i].stage.pName = "main";
+        pipelineInfos[i].stage.pSpecializationInfo = &specializationInfos[i];
+        pipelineInfos[i].layout = particles->pipelineLayout;
+        pipelineInfos[i].basePipelineHandle = VK_NULL_HANDLE;
+        pipelineInfos[i].basePipelineIndex = -1;
+    }
+    if (vkCreateComputePipelines(device, VK_NULL_HANDLE, PARTICLE_PASS_COUNT, pipelineInfos, NULL, particles->compute) != VK_SUCCESS) {
+        fprintf(stderr, "ERROR Vulkan: failed to create particle compute pipelines\n");
+    }
+    for (uint32_t i = 0; i < PARTICLE_PASS_COUNT; ++i) {
+        vkDestroyShaderModule(device, pipelineInfos[i].stage.module, NULL);
+    }
+
+    particles->render = VK_NULL_HANDLE;
+    if (renderPass != VK_NULL_HANDLE) {
+        createParticleRenderPipeline(device, renderPass, imageExtent, particles);
+    }
+    printf("INFO Vulkan: created %u particle compute pipelines%s\n", PARTICLE_PASS_COUNT,
+           renderPass != VK_NULL_HANDLE ? " and the particle graphics pipeline" : "");
+}
+
+/* The particles are emitted at a rate that keeps about maxParticles alive. The compute
+ * passes run on the graphics queue, so it has to support compute as well. The particle
+ * count shrinks to what fits below the memory pressure threshold of the device local heap,
+ * and no particle system is created on a heap that is already under pressure. */
+bool createParticleSystem(SurfaceAndDevice *surfaceAndDevice, VkRenderPass renderPass, const VkExtent2D *imageExtent,
+                          uint32_t maxParticles, ParticleSystem *particles) {
+    if (!checkQueueFamilySupport(surfaceAndDevice->physicalDevice, surfaceAndDevice->queueIndex, VK_QUEUE_COMPUTE_BIT)) {
+        fprintf(stderr, "ERROR particles: queue family %u does not support compute\n", surfaceAndDevice->queueIndex);
+        return false;
+    }
+    // every particle pass dispatches at most one invocation per particle in x
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(surfaceAndDevice->physicalDevice, &deviceProperties);
+    uint64_t limit = (uint64_t) deviceProperties.limits.maxComputeWorkGroupCount[0] * PARTICLE_GROUP_SIZE;
+    if (maxParticles > limit) {
+        printf("INFO particles: limited to %u particles by the compute work group count\n", (uint32_t) limit);
+        maxParticles = (uint32_t) limit;
+    }
+    MemoryTracker *tracker = &surfaceAndDevice->memoryTracker;
+    uint32_t heap = findMemoryHeap(tracker, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    VkDeviceSize headroom = memoryHeapHeadroom(tracker, heap);
+    if (memoryHeapUnderPressure(tracker, heap) || headroom < sizeof(ParticleState) + PARTICLE_BYTES) {
+        fprintf(stderr, "ERROR particles: device local heap %u has no room below the memory budget\n", heap);
+        return false;
+    }
+    uint64_t fitting = (headroom - sizeof(ParticleState)) / PARTICLE_BYTES;
+    if (maxParticles > fitting) {
+        printf("INFO particles: limited to %u particles by the memory budget of heap %u\n", (uint32_t) fitting, heap);
+        maxParticles = (uint32_t) fitting;
+    }
+    memset(particles, 0, sizeof(*particles));
+    particles->maxParticles = maxParticles;
+    particles->emitRate = maxParticles / PARTICLE_MEAN_LIFETIME;
+    particles->seed = 1;
+    createParticleBuffers(surfaceAndDevice, particles);
+    createParticleDescriptors(surfaceAndDevice->device, particles);
+    createParticlePipelines(surfaceAndDevice->device, renderPass, imageExtent, particles);
+    printf("INFO particles: %u particles max, %.0f emitted per second, %.1f MiB of storage buffers\n",
+           maxParticles, particles->emitRate, (double) maxParticles * PARTICLE_BYTES / (1024.0 * 1024.0));
+    return true;
 }
 
-void cleanUp(GLFWwindow *window, SurfaceAndDevice *surfaceAndDevice, SwapchainAndViews *swapchainAndViews, Pipeline *pipeline, Buffers *buffers) {
-    destroyBuffers(surfaceAndDevice->device, swapchainAndViews->imageCount, buffers);
-    destroyPipeline(surfaceAndDevice->device, pipeline);
-    destroySwapchainAndViews(surfaceAndDevice->device, swapchainAndViews);
-    destroySurfaceAndDevice(surfaceAndDevice);
+void destroyParticleSystem(SurfaceAndDevice *surfaceAndDevice, ParticleSystem *particles) {
+    VkDevice device = surfaceAndDevice->device;
+    if (particles->render != VK_NULL_HANDLE) {
+        vkDestroyPipeline(device, particles->render, NULL);
+    }
+    for (uint32_t i = 0; i < PARTICLE_PASS_COUNT; ++i) {
+        vkDestroyPipeline(device, particles->compute[i], NULL);
+    }
+    vkDestroyPipelineLayout(device, particles->pipelineLayout, NULL);
+    vkDestroyDescriptorPool(device, particles->descriptorPool, NULL);
+    vkDestroyDescriptorSetLayout(device, particles->descriptorSetLayout, NULL);
+    for (uint32_t i = 0; i < PARTICLE_BUFFER_COUNT; ++i) {
+        vkDestroyBuffer(device, particles->buffers[i], NULL);
+        freeTrackedMemory(&surfaceAndDevice->memoryTracker, device, particles->bufferMemory[i]);
+    }
+}
+
+/* Copies the state buffer back, for the final report only. */
+void readParticleState(SurfaceAndDevice *surfaceAndDevice, VkCommandPool commandPool, ParticleSystem *particles, ParticleState *state) {
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingBufferMemory;
+    createBuffer(surfaceAndDevice, sizeof(ParticleState), VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 MEMORY_CATEGORY_STAGING, &stagingBuffer, &stagingBufferMemory);
+    copyBuffer(surfaceAndDevice, commandPool, particles->buffers[PARTICLE_BUFFER_STATE], stagingBuffer, 0, sizeof(ParticleState));
+    void *data;
+    vkMapMemory(surfaceAndDevice->device, stagingBufferMemory, 0, sizeof(ParticleState), 0, &data);
+    memcpy(state, data, sizeof(ParticleState));
+    vkUnmapMemory(surfaceAndDevice->device, stagingBufferMemory);
+    vkDestroyBuffer(surfaceAndDevice->device, stagingBuffer, NULL);
+    freeTrackedMemory(&surfaceAndDevice->memoryTracker, surfaceAndDevice->device, stagingBufferMemory);
+}
+
+double wallClock(void) {
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return time.tv_sec + 1e-9 * time.tv_nsec;
+}
+
+/* Records PARTICLE_BENCH_FRAMES simulation steps into the batches with one timestamp pair
+ * around all of them, submits them together and waits for the queue once. wallTime spans
+ * the submission to the end of the run. */
+bool submitParticleSteps(SurfaceAndDevice *surfaceAndDevice, ParticleSystem *particles, VkQueryPool queryPool,
+                         const VkCommandBuffer *commandBuffers, uint32_t batchCount, double *wallTime) {
+    uint32_t frame = 0;
+    for (uint32_t batch = 0; batch < batchCount; ++batch) {
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        if (vkBeginCommandBuffer(commandBuffers[batch], &beginInfo) != VK_SUCCESS) {
+            fprintf(stderr, "ERROR Vulkan: failed to begin recording command buffer\n");
+            return false;
+        }
+        if (batch == 0 && queryPool != VK_NULL_HANDLE) {
+            vkCmdResetQueryPool(commandBuffers[batch], queryPool, 0, 2);
+            vkCmdWriteTimestamp(commandBuffers[batch], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+        }
+        for (uint32_t step = 0; step < PARTICLE_BENCH_STEPS_PER_BATCH && frame < PARTICLE_BENCH_FRAMES; ++step, ++frame) {
+            recordParticleSimulation(particles, commandBuffers[batch], PARTICLE_BENCH_DELTA_TIME);
+        }
+        if (batch + 1 == batchCount && queryPool != VK_NULL_HANDLE) {
+            vkCmdWriteTimestamp(commandBuffers[batch], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+        }
+        if (vkEndCommandBuffer(commandBuffers[batch]) != VK_SUCCESS) {
+            fprintf(stderr, "ERROR Vulkan: failed to record command buffer\n");
+            return false;
+        }
+    }
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = batchCount;
+    submitInfo.pCommandBuffers = commandBuffers;
+    double start = wallClock();
+    if (vkQueueSubmit(surfaceAndDevice->queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+        fprintf(stderr, "ERROR Vulkan: failed to submit particle command buffers\n");
+        return false;
+    }
+    if (vkQueueWaitIdle(surfaceAndDevice->queue) != VK_SUCCESS) {
+        fprintf(stderr, "ERROR Vulkan: particle command buffers did not complete\n");
+        return false;
+    }
+    *wallTime = wallClock() - start;
+    return true;
+}
+
+/* Runs PARTICLE_BENCH_FRAMES fixed simulation steps on a headless device, without window,
+ * surface or render pass. All steps are recorded up front and submitted together, the
+ * queue is waited on and the single timestamp pair around them read only once at the end.
+ * The throughput counts every alive particle of every step. */
+int runParticleBenchmark(uint32_t maxParticles) {
+    SurfaceAndDevice surfaceAndDevice = {};
+    Buffers buffers = {};
+    ParticleSystem particles;
+    createSurfaceAndDevice(NULL, &surfaceAndDevice);
+    if (surfaceAndDevice.device == VK_NULL_HANDLE) {
+        return EXIT_FAILURE;
+    }
+    VkDevice device = surfaceAndDevice.device;
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(surfaceAndDevice.physicalDevice, &deviceProperties);
+    printf("Vulkan GPU name: %s\n", deviceProperties.deviceName);
+    createCommandPool(&surfaceAndDevice, &buffers);
+    createTimestampQueries(&surfaceAndDevice, &buffers);
+    VkQueryPool queryPool = buffers.timestampQueryPool;
+    uint32_t batchCount = (PARTICLE_BENCH_FRAMES + PARTICLE_BENCH_STEPS_PER_BATCH - 1) / PARTICLE_BENCH_STEPS_PER_BATCH;
+    VkCommandBuffer *commandBuffers = (VkCommandBuffer *) malloc(batchCount * sizeof(VkCommandBuffer));
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = buffers.commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = batchCount;
+    bool allocated = vkAllocateCommandBuffers(device, &allocInfo, commandBuffers) == VK_SUCCESS;
+    bool success = allocated && createParticleSystem(&surfaceAndDevice, VK_NULL_HANDLE, NULL, maxParticles, &particles);
+    if (!success) {
+        fprintf(stderr, "ERROR particles: failed to set up the benchmark\n");
+    } else {
+        double wallTime = 0.0;
+        success = submitParticleSteps(&surfaceAndDevice, &particles, queryPool, commandBuffers, batchCount, &wallTime);
+        if (success) {
+            double gpuTime = readGpuTime(device, &buffers);
+            ParticleState state;
+            readParticleState(&surfaceAndDevice, buffers.commandPool, &particles, &state);
+            double simulated = 4294967296.0 * state.simulatedHigh + state.simulatedLow;
+            printf("INFO particles: %u steps of %.1f ms, %u of %u particles alive at the end, %.0f particle updates\n",
+                   state.frame, 1000.0 * PARTICLE_BENCH_DELTA_TIME, state.aliveCount[particles.parity], particles.maxParticles, simulated);
+            printf("INFO particles: wall %.3f ms per step, %.1f M particles/s\n",
+                   1000.0 * wallTime / PARTICLE_BENCH_FRAMES, 1e-6 * simulated / wallTime);
+            if (gpuTime > 0.0) {
+                printf("INFO particles: GPU %.3f ms per step, %.1f M particles/s\n",
+                       gpuTime / PARTICLE_BENCH_FRAMES, 1e-3 * simulated / gpuTime);
+            }
+            updateMemoryBudget(&surfaceAndDevice.memoryTracker);
+            printMemoryStats(&surfaceAndDevice.memoryTracker);
+        }
+        // a failed submission may have left work behind on the queue
+        vkDeviceWaitIdle(device);
+        destroyParticleSystem(&surfaceAndDevice, &particles);
+    }
+
+    if (queryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, queryPool, NULL);
+    }
+    if (allocated) {
+        vkFreeCommandBuffers(device, buffers.commandPool, batchCount, commandBuffers);
+    }
+    free(commandBuffers);
+    vkDestroyCommandPool(device, buffers.commandPool, NULL);
+    destroySurfaceAndDevice(&surfaceAndDevice);
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Particles are only simulated and drawn with maxParticles above zero. */
+void initVulkan(GLFWwindow *window, const char meshFilename[], uint32_t maxParticles, VulkanStuff *vulkan) {
+    createSurfaceAndDevice(window, vulkan->surfaceAndDevice);
+    createSwapchainAndViews(vulkan->surfaceAndDevice, vulkan->swapchainAndViews);
+    createPipeline(vulkan->surfaceAndDevice->device, vulkan->swapchainAndViews, vulkan->pipeline);
+    createBuffers(vulkan->surfaceAndDevice, vulkan->swapchainAndViews, vulkan->pipeline, vulkan->buffers, meshFilename, vulkan->meshBuffers);
+    createScene(&vulkan->swapchainAndViews->imageExtent, vulkan->meshBuffers, vulkan->scene);
+    createInstanceBuffer(vulkan->surfaceAndDevice, vulkan->scene);
+    if (maxParticles == 0 || !createParticleSystem(vulkan->surfaceAndDevice, vulkan->pipeline->renderPass,
+                                                   &vulkan->swapchainAndViews->imageExtent, maxParticles, vulkan->particles)) {
+        vulkan->particles = NULL;
+    }
+}
+
+void cleanUp(GLFWwindow *window, VulkanStuff *vulkan) {
+    VkDevice device = vulkan->surfaceAndDevice->device;
+    if (vulkan->particles != NULL) {
+        destroyParticleSystem(vulkan->surfaceAndDevice, vulkan->particles);
+    }
+    destroyInstanceBuffer(vulkan->surfaceAndDevice, vulkan->scene);
+    destroyScene(vulkan->scene);
+    destroyMeshBuffers(vulkan->surfaceAndDevice, vulkan->meshBuffers);
+    destroyBuffers(device, vulkan->swapchainAndViews->imageCount, vulkan->buffers);
+    destroyPipeline(device, vulkan->pipeline);
+    destroySwapchainAndViews(vulkan->surfaceAndDevice, vulkan->swapchainAndViews);
+    destroySurfaceAndDevice(vulkan->surfaceAndDevice);
     glfwDestroyWindow(window);
     glfwTerminate();
 }
@@ -832,10 +2477,43 @@ int main(const int argc, const char *argv[]) {
     SwapchainAndViews swapchainAndViews;
     Pipeline pipeline;
     Buffers buffers;
-    VulkanStuff vulkan = {&surfaceAndDevice, &swapchainAndViews, &pipeline, &buffers};
+    MeshBuffers meshBuffers;
+    Scene scene;
+    FrameStats frameStats = {};
+    ShaderBenchmark shaderBenchmark = {};
+    FrameScheduler scheduler = {};
+    ParticleSystem particles;
+    VulkanStuff vulkan = {&surfaceAndDevice, &swapchainAndViews, &pipeline, &buffers, &meshBuffers, &scene, &frameStats, &shaderBenchmark, &scheduler, &particles};
+    const char *meshFilename = DEFAULT_MESH;
+    double maxFps = DEFAULT_MAX_FPS;
+    uint32_t maxParticles = 0;
+    bool headless = false;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--on-demand") == 0) {
+            scheduler.onDemand = true;
+        } else if (strcmp(argv[i], "--max-fps") == 0 && i + 1 < argc) {
+            maxFps = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--particles") == 0 && i + 1 < argc) {
+            maxParticles = (uint32_t) strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Usage: %s [--on-demand] [--max-fps <fps>] [--particles <count>] [--headless] [mesh.vmesh]\n"
+                            "  --on-demand only redraws when something changed, at most <fps> times a second\n"
+                            "  --headless only runs the particle benchmark, without a window\n", argv[0]);
+            return EXIT_FAILURE;
+        } else {
+            meshFilename = argv[i];
+        }
+    }
+    if (headless) {
+        return runParticleBenchmark(maxParticles > 0 ? maxParticles : PARTICLE_BENCH_DEFAULT_COUNT);
+    }
+    scheduler.frameInterval = maxFps > 0.0 ? 1.0 / maxFps : 0.0;
     initWindow(&window);
-    initVulkan(window, &surfaceAndDevice, &swapchainAndViews, &pipeline, &buffers);
+    initVulkan(window, meshFilename, maxParticles, &vulkan);
+    glfwSetWindowUserPointer(window, &vulkan);
     mainLoop(window, &vulkan);
-    cleanUp(window, &surfaceAndDevice, &swapchainAndViews, &pipeline, &buffers);
+    cleanUp(window, &vulkan);
     return 0;
 }
\ No newline at end of file
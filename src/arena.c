@@ -0,0 +1,35 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "arena.h"
+
+bool createFrameArena(size_t size, FrameArena *arena) {
+    arena->base = (uint8_t *) malloc(size);
+    arena->size = arena->base != NULL ? size : 0;
+    arena->used = 0;
+    arena->peak = 0;
+    return arena->base != NULL;
+}
+
+void destroyFrameArena(FrameArena *arena) {
+    free(arena->base);
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
+
+/* alignment must be a power of two. Returns NULL when the arena is exhausted. */
+void *frameArenaAlloc(FrameArena *arena, size_t size, size_t alignment) {
+    size_t offset = (arena->used + alignment - 1) & ~(alignment - 1);
+    if (offset + size > arena->size) {
+        fprintf(stderr, "ERROR arena: out of memory, %zu of %zu bytes used, %zu requested\n", arena->used, arena->size, size);
+        return NULL;
+    }
+    arena->used = offset + size;
+    if (arena->used > arena->peak) arena->peak = arena->used;
+    return arena->base + offset;
+}
+
+void frameArenaReset(FrameArena *arena) {
+    arena->used = 0;
+}
@@ -0,0 +1,22 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Linear allocator for data that lives for one frame. It is allocated once and reset at the
+ * start of every frame, so building per-frame data never calls malloc. */
+typedef struct {
+    uint8_t *base;
+    size_t size;
+    size_t used;
+    size_t peak;
+} FrameArena;
+
+bool createFrameArena(size_t size, FrameArena *arena);
+void destroyFrameArena(FrameArena *arena);
+void *frameArenaAlloc(FrameArena *arena, size_t size, size_t alignment);
+void frameArenaReset(FrameArena *arena);
+
+#endif
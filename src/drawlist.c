@@ -0,0 +1,103 @@
+#include <string.h>
+
+#include "drawlist.h"
+
+bool beginDrawList(DrawList *list, FrameArena *arena, uint32_t capacity) {
+    list->arena = arena;
+    list->commands = (DrawCommand *) frameArenaAlloc(arena, (size_t) capacity * sizeof(DrawCommand), 8);
+    list->order = NULL;
+    list->count = 0;
+    list->capacity = list->commands != NULL ? capacity : 0;
+    return list->commands != NULL;
+}
+
+bool pushDraw(DrawList *list, uint64_t key, uint32_t firstIndex, uint32_t indexCount, uint32_t firstInstance) {
+    if (list->count == list->capacity) {
+        return false;
+    }
+    DrawCommand *command = &list->commands[list->count++];
+    command->key = key;
+    command->firstIndex = firstIndex;
+    command->indexCount = indexCount;
+    command->firstInstance = firstInstance;
+    command->reserved = 0;
+    list->order = NULL;
+    return true;
+}
+
+/* Stable LSD radix sort of the keys with 8 bit digits, carrying the command indices along.
+ * All digit histograms are built in one pass, and passes whose digit is the same for every key
+ * (usually the pipeline and material bytes) are skipped. The commands themselves stay put. */
+bool sortDrawList(DrawList *list) {
+    uint32_t count = list->count;
+    uint64_t *keys = (uint64_t *) frameArenaAlloc(list->arena, 2 * (size_t) count * sizeof(uint64_t), 8);
+    uint32_t *order = (uint32_t *) frameArenaAlloc(list->arena, 2 * (size_t) count * sizeof(uint32_t), 4);
+    if (keys == NULL || order == NULL) {
+        return false;
+    }
+    uint64_t *keysTemp = keys + count;
+    uint32_t *orderTemp = order + count;
+    uint32_t histograms[8][256];
+    memset(histograms, 0, sizeof(histograms));
+    for (uint32_t i = 0; i < count; ++i) {
+        uint64_t key = list->commands[i].key;
+        keys[i] = key;
+        order[i] = i;
+        for (uint32_t digit = 0; digit < 8; ++digit) {
+            histograms[digit][(key >> (8 * digit)) & 0xff]++;
+        }
+    }
+    for (uint32_t digit = 0; digit < 8 && count > 0; ++digit) {
+        uint32_t shift = 8 * digit;
+        uint32_t *histogram = histograms[digit];
+        if (histogram[(keys[0] >> shift) & 0xff] == count) continue;
+        uint32_t offset = 0;
+        for (uint32_t bucket = 0; bucket < 256; ++bucket) {
+            uint32_t bucketCount = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += bucketCount;
+        }
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t destination = histogram[(keys[i] >> shift) & 0xff]++;
+            keysTemp[destination] = keys[i];
+            orderTemp[destination] = order[i];
+        }
+        uint64_t *swapKeys = keys;
+        keys = keysTemp;
+        keysTemp = swapKeys;
+        uint32_t *swapOrder = order;
+        order = orderTemp;
+        orderTemp = swapOrder;
+    }
+    list->order = order;
+    return true;
+}
+
+DrawStats emitDrawList(const DrawList *list, const DrawEmitter *emitter) {
+    DrawStats stats = {};
+    uint32_t pipeline = UINT32_MAX, material = UINT32_MAX, mesh = UINT32_MAX;
+    for (uint32_t i = 0; i < list->count; ++i) {
+        const DrawCommand *command = &list->commands[list->order != NULL ? list->order[i] : i];
+        uint32_t commandPipeline = drawKeyPipeline(command->key);
+        uint32_t commandMaterial = drawKeyMaterial(command->key);
+        uint32_t commandMesh = drawKeyMesh(command->key);
+        if (commandPipeline != pipeline) {
+            emitter->bindPipeline(emitter->context, commandPipeline);
+            pipeline = commandPipeline;
+            stats.pipelineBinds++;
+        }
+        if (commandMaterial != material) {
+            emitter->bindMaterial(emitter->context, commandMaterial);
+            material = commandMaterial;
+            stats.materialBinds++;
+        }
+        if (commandMesh != mesh) {
+            emitter->bindMesh(emitter->context, commandMesh);
+            mesh = commandMesh;
+            stats.meshBinds++;
+        }
+        emitter->draw(emitter->context, command);
+        stats.draws++;
+    }
+    return stats;
+}
@@ -0,0 +1,70 @@
+#ifndef DRAWLIST_H
+#define DRAWLIST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "arena.h"
+
+/* Sort key layout, most expensive state change in the highest bits:
+ * 63..56 pipeline, 55..40 material, 39..24 mesh, 23..0 depth (front to back). */
+#define DRAW_KEY_PIPELINE_SHIFT 56
+#define DRAW_KEY_MATERIAL_SHIFT 40
+#define DRAW_KEY_MESH_SHIFT 24
+#define DRAW_KEY_DEPTH_BITS 24
+
+typedef struct {
+    uint64_t key;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    uint32_t firstInstance;
+    uint32_t reserved;
+} DrawCommand;
+
+/* commands and order live in the frame arena. order is NULL until the list is sorted, the
+ * commands are then emitted in insertion order. */
+typedef struct {
+    FrameArena *arena;
+    DrawCommand *commands;
+    uint32_t *order;
+    uint32_t count;
+    uint32_t capacity;
+} DrawList;
+
+typedef struct {
+    uint32_t pipelineBinds;
+    uint32_t materialBinds;
+    uint32_t meshBinds;
+    uint32_t draws;
+} DrawStats;
+
+/* Receives the commands of emitDrawList, a bind callback is only called when the value
+ * differs from the previous draw. */
+typedef struct {
+    void *context;
+    void (*bindPipeline)(void *context, uint32_t pipeline);
+    void (*bindMaterial)(void *context, uint32_t material);
+    void (*bindMesh)(void *context, uint32_t mesh);
+    void (*draw)(void *context, const DrawCommand *command);
+} DrawEmitter;
+
+/* depth is clamped to 0..1 */
+static inline uint64_t drawKey(uint32_t pipeline, uint32_t material, uint32_t mesh, float depth) {
+    float clamped = depth < 0.0f ? 0.0f : depth > 1.0f ? 1.0f : depth;
+    uint64_t quantized = (uint64_t) (clamped * (float) ((1u << DRAW_KEY_DEPTH_BITS) - 1));
+    return (uint64_t) (pipeline & 0xffu) << DRAW_KEY_PIPELINE_SHIFT
+         | (uint64_t) (material & 0xffffu) << DRAW_KEY_MATERIAL_SHIFT
+         | (uint64_t) (mesh & 0xffffu) << DRAW_KEY_MESH_SHIFT
+         | quantized;
+}
+
+static inline uint32_t drawKeyPipeline(uint64_t key) { return (uint32_t) (key >> DRAW_KEY_PIPELINE_SHIFT) & 0xffu; }
+static inline uint32_t drawKeyMaterial(uint64_t key) { return (uint32_t) (key >> DRAW_KEY_MATERIAL_SHIFT) & 0xffffu; }
+static inline uint32_t drawKeyMesh(uint64_t key) { return (uint32_t) (key >> DRAW_KEY_MESH_SHIFT) & 0xffffu; }
+
+bool beginDrawList(DrawList *list, FrameArena *arena, uint32_t capacity);
+bool pushDraw(DrawList *list, uint64_t key, uint32_t firstIndex, uint32_t indexCount, uint32_t firstInstance);
+bool sortDrawList(DrawList *list);
+DrawStats emitDrawList(const DrawList *list, const DrawEmitter *emitter);
+
+#endif
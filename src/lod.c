@@ -0,0 +1,76 @@
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "lod.h"
+
+/* The coarsest LOD whose object-space error, projected at the distance of the nearest point
+ * of the bounding sphere, stays under the pixel threshold. LOD errors never decrease, which
+ * meshBuildLods guarantees and mapMeshFile checks, so this is the number of LODs that pass
+ * the test minus one. */
+void selectLodsScalar(const LodInstances *instances, uint32_t first, uint32_t last, const LodCamera *camera,
+                      const MeshLod *lods, uint32_t lodCount, uint8_t *selected) {
+    for (uint32_t i = first; i < last; ++i) {
+        float dx = instances->centerX[i] - camera->position[0];
+        float dy = instances->centerY[i] - camera->position[1];
+        float dz = instances->centerZ[i] - camera->position[2];
+        float distance = sqrtf(dx * dx + dy * dy + dz * dz) - instances->radius[i];
+        if (distance < 1e-3f) distance = 1e-3f;
+        float allowedError = camera->threshold * distance / (camera->projectionScale * instances->scale[i]);
+        uint8_t lod = 0;
+        for (uint32_t l = 1; l < lodCount; ++l) {
+            lod += lods[l].error <= allowedError;
+        }
+        selected[i] = lod;
+    }
+}
+
+#if defined(__SSE2__)
+static void selectLodsSse(const LodInstances *instances, uint32_t count, const LodCamera *camera,
+                          const MeshLod *lods, uint32_t lodCount, uint8_t *selected) {
+    __m128 cameraX = _mm_set1_ps(camera->position[0]);
+    __m128 cameraY = _mm_set1_ps(camera->position[1]);
+    __m128 cameraZ = _mm_set1_ps(camera->position[2]);
+    __m128 factor = _mm_set1_ps(camera->threshold / camera->projectionScale);
+    __m128 minDistance = _mm_set1_ps(1e-3f);
+    __m128 errors[MESH_MAX_LODS];
+    for (uint32_t l = 1; l < lodCount; ++l) {
+        errors[l] = _mm_set1_ps(lods[l].error);
+    }
+    for (uint32_t i = 0; i < count; i += 4) {
+        __m128 dx = _mm_sub_ps(_mm_loadu_ps(&instances->centerX[i]), cameraX);
+        __m128 dy = _mm_sub_ps(_mm_loadu_ps(&instances->centerY[i]), cameraY);
+        __m128 dz = _mm_sub_ps(_mm_loadu_ps(&instances->centerZ[i]), cameraZ);
+        __m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+        __m128 distance = _mm_sub_ps(_mm_sqrt_ps(lengthSquared), _mm_loadu_ps(&instances->radius[i]));
+        distance = _mm_max_ps(distance, minDistance);
+        __m128 allowedError = _mm_div_ps(_mm_mul_ps(factor, distance), _mm_loadu_ps(&instances->scale[i]));
+        __m128i lod = _mm_setzero_si128();
+        for (uint32_t l = 1; l < lodCount; ++l) {
+            /* the comparison mask is -1 per passing lane */
+            lod = _mm_sub_epi32(lod, _mm_castps_si128(_mm_cmple_ps(errors[l], allowedError)));
+        }
+        lod = _mm_packs_epi32(lod, lod);
+        lod = _mm_packus_epi16(lod, lod);
+        int packed = _mm_cvtsi128_si32(lod);
+        selected[i] = (uint8_t) packed;
+        selected[i + 1] = (uint8_t) (packed >> 8);
+        selected[i + 2] = (uint8_t) (packed >> 16);
+        selected[i + 3] = (uint8_t) (packed >> 24);
+    }
+}
+#endif
+
+void selectLods(const LodInstances *instances, const LodCamera *camera,
+                const MeshLod *lods, uint32_t lodCount, uint8_t *selected) {
+    uint32_t first = 0;
+#if defined(__SSE2__)
+    if (instances->count >= LOD_SIMD_THRESHOLD) {
+        first = instances->count & ~3u;
+        selectLodsSse(instances, first, camera, lods, lodCount, selected);
+    }
+#endif
+    selectLodsScalar(instances, first, instances->count, camera, lods, lodCount, selected);
+}
@@ -0,0 +1,34 @@
+#ifndef LOD_H
+#define LOD_H
+
+#include <stdint.h>
+
+#include "mesh.h"
+
+/* Instances below this count are selected with the scalar loop only. */
+#define LOD_SIMD_THRESHOLD 64
+
+/* Bounding spheres of the instances as structure of arrays. */
+typedef struct {
+    uint32_t count;
+    float *centerX;
+    float *centerY;
+    float *centerZ;
+    float *radius;
+    float *scale;
+} LodInstances;
+
+typedef struct {
+    float position[3];
+    /* viewport height / (2 tan(fovy / 2)), converts view-space size at distance 1 to pixels */
+    float projectionScale;
+    /* largest acceptable geometric error in pixels */
+    float threshold;
+} LodCamera;
+
+void selectLodsScalar(const LodInstances *instances, uint32_t first, uint32_t last, const LodCamera *camera,
+                      const MeshLod *lods, uint32_t lodCount, uint8_t *selected);
+void selectLods(const LodInstances *instances, const LodCamera *camera,
+                const MeshLod *lods, uint32_t lodCount, uint8_t *selected);
+
+#endif
@@ -0,0 +1,194 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "memory.h"
+
+const char *const memoryCategoryNames[MEMORY_CATEGORY_COUNT] = {
+    "buffers",
+    "images",
+    "staging",
+    "swapchain"
+};
+
+static const double MEBIBYTE = 1024.0 * 1024.0;
+
+static VkDeviceSize appHeapUsage(const MemoryTracker *tracker, uint32_t heap) {
+    return tracker->heapAllocated[heap] + (heap == tracker->swapchainHeap ? tracker->swapchainEstimate : 0);
+}
+
+static bool heapUnderPressure(const MemoryTracker *tracker, uint32_t heap) {
+    return tracker->heapBudget[heap] > 0
+        && tracker->heapUsage[heap] >= tracker->pressureThreshold * tracker->heapBudget[heap];
+}
+
+/* Notifies the pressure callback once when usage crosses the threshold. It is re-armed when
+ * usage drops below the threshold again. */
+static void checkMemoryPressure(MemoryTracker *tracker, uint32_t heap) {
+    bool pressure = heapUnderPressure(tracker, heap);
+    if (pressure && !tracker->underPressure[heap] && tracker->pressureCallback != NULL) {
+        tracker->pressureCallback(heap, tracker->heapUsage[heap], tracker->heapBudget[heap], tracker->pressureUserData);
+    }
+    tracker->underPressure[heap] = pressure;
+}
+
+/* Follows an allocation or free without asking the driver. Only a heap that newly crosses
+ * the pressure threshold is confirmed with a budget query. */
+static void updateHeapUsage(MemoryTracker *tracker, uint32_t heap) {
+    int64_t usage = tracker->heapBaseline[heap] + (int64_t) appHeapUsage(tracker, heap);
+    tracker->heapUsage[heap] = usage > 0 ? (VkDeviceSize) usage : 0;
+    if (tracker->budgetExtension && heapUnderPressure(tracker, heap) && !tracker->underPressure[heap]) {
+        updateMemoryBudget(tracker);
+        return;
+    }
+    checkMemoryPressure(tracker, heap);
+}
+
+void createMemoryTracker(VkPhysicalDevice physicalDevice, bool budgetExtension, MemoryTracker *tracker) {
+    memset(tracker, 0, sizeof(*tracker));
+    tracker->physicalDevice = physicalDevice;
+    tracker->budgetExtension = budgetExtension;
+    tracker->pressureThreshold = MEMORY_DEFAULT_PRESSURE_THRESHOLD;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &tracker->properties);
+    for (uint32_t i = 0; i < tracker->properties.memoryTypeCount; ++i) {
+        if (tracker->properties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+            tracker->swapchainHeap = tracker->properties.memoryTypes[i].heapIndex;
+            break;
+        }
+    }
+    updateMemoryBudget(tracker);
+    printf("INFO memory: %u heaps, budget from %s\n", tracker->properties.memoryHeapCount,
+           budgetExtension ? VK_EXT_MEMORY_BUDGET_EXTENSION_NAME : "heap sizes");
+}
+
+void destroyMemoryTracker(MemoryTracker *tracker) {
+    if (tracker->allocationCount > 0) {
+        fprintf(stderr, "ERROR memory: %u allocations still alive\n", tracker->allocationCount);
+    }
+    free(tracker->allocations);
+    tracker->allocations = NULL;
+    tracker->allocationCount = 0;
+    tracker->allocationCapacity = 0;
+}
+
+void setMemoryPressureCallback(MemoryTracker *tracker, float threshold, MemoryPressureCallback callback, void *userData) {
+    tracker->pressureThreshold = threshold;
+    tracker->pressureCallback = callback;
+    tracker->pressureUserData = userData;
+}
+
+VkResult allocateTrackedMemory(MemoryTracker *tracker, VkDevice device, const VkMemoryAllocateInfo *allocInfo,
+                               MemoryCategory category, VkDeviceMemory *memory) {
+    VkResult result = vkAllocateMemory(device, allocInfo, NULL, memory);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+    if (tracker->allocationCount == tracker->allocationCapacity) {
+        tracker->allocationCapacity = tracker->allocationCapacity ? 2 * tracker->allocationCapacity : 32;
+        tracker->allocations = (TrackedAllocation *) realloc(tracker->allocations, tracker->allocationCapacity * sizeof(TrackedAllocation));
+    }
+    TrackedAllocation *allocation = &tracker->allocations[tracker->allocationCount++];
+    allocation->memory = *memory;
+    allocation->size = allocInfo->allocationSize;
+    allocation->heapIndex = tracker->properties.memoryTypes[allocInfo->memoryTypeIndex].heapIndex;
+    allocation->category = category;
+    tracker->heapAllocated[allocation->heapIndex] += allocation->size;
+    tracker->categoryAllocated[category] += allocation->size;
+    if (tracker->categoryAllocated[category] > tracker->categoryPeak[category]) {
+        tracker->categoryPeak[category] = tracker->categoryAllocated[category];
+    }
+    updateHeapUsage(tracker, allocation->heapIndex);
+    return result;
+}
+
+void freeTrackedMemory(MemoryTracker *tracker, VkDevice device, VkDeviceMemory memory) {
+    if (memory == VK_NULL_HANDLE) return;
+    for (uint32_t i = 0; i < tracker->allocationCount; ++i) {
+        TrackedAllocation *allocation = &tracker->allocations[i];
+        if (allocation->memory == memory) {
+            tracker->heapAllocated[allocation->heapIndex] -= allocation->size;
+            tracker->categoryAllocated[allocation->category] -= allocation->size;
+            uint32_t heap = allocation->heapIndex;
+            *allocation = tracker->allocations[--tracker->allocationCount];
+            updateHeapUsage(tracker, heap);
+            break;
+        }
+    }
+    vkFreeMemory(device, memory, NULL);
+}
+
+/* Swapchain images are owned by the driver, so their size can only be estimated. */
+void setSwapchainMemoryEstimate(MemoryTracker *tracker, VkDeviceSize size) {
+    tracker->categoryAllocated[MEMORY_CATEGORY_SWAPCHAIN] = size;
+    if (size > tracker->categoryPeak[MEMORY_CATEGORY_SWAPCHAIN]) {
+        tracker->categoryPeak[MEMORY_CATEGORY_SWAPCHAIN] = size;
+    }
+    tracker->swapchainEstimate = size;
+    updateHeapUsage(tracker, tracker->swapchainHeap);
+}
+
+/* Queries usage and budget of every heap and checks them against the pressure threshold.
+ * Called for the periodic stats, allocations only update the app's share of the usage. */
+void updateMemoryBudget(MemoryTracker *tracker) {
+    uint32_t heapCount = tracker->properties.memoryHeapCount;
+    if (tracker->budgetExtension) {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {};
+        budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+        VkPhysicalDeviceMemoryProperties2 properties = {};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+        properties.pNext = &budgetProperties;
+        vkGetPhysicalDeviceMemoryProperties2(tracker->physicalDevice, &properties);
+        for (uint32_t i = 0; i < heapCount; ++i) {
+            tracker->heapBudget[i] = budgetProperties.heapBudget[i];
+            tracker->heapUsage[i] = budgetProperties.heapUsage[i];
+            tracker->heapBaseline[i] = (int64_t) budgetProperties.heapUsage[i] - (int64_t) appHeapUsage(tracker, i);
+        }
+    } else {
+        for (uint32_t i = 0; i < heapCount; ++i) {
+            tracker->heapBudget[i] = (VkDeviceSize) (tracker->properties.memoryHeaps[i].size * MEMORY_FALLBACK_BUDGET);
+            tracker->heapUsage[i] = appHeapUsage(tracker, i);
+            tracker->heapBaseline[i] = 0;
+        }
+    }
+    for (uint32_t i = 0; i < heapCount; ++i) {
+        checkMemoryPressure(tracker, i);
+    }
+}
+
+/* Heap of the first memory type with all the given properties, like findMemoryType picks
+ * the type. Falls back to heap 0. */
+uint32_t findMemoryHeap(const MemoryTracker *tracker, VkMemoryPropertyFlags properties) {
+    for (uint32_t i = 0; i < tracker->properties.memoryTypeCount; ++i) {
+        if ((tracker->properties.memoryTypes[i].propertyFlags & properties) == properties) {
+            return tracker->properties.memoryTypes[i].heapIndex;
+        }
+    }
+    return 0;
+}
+
+/* Whether the heap was at or above the pressure threshold after the last update. */
+bool memoryHeapUnderPressure(const MemoryTracker *tracker, uint32_t heap) {
+    return tracker->underPressure[heap];
+}
+
+/* Bytes that can still be allocated from the heap before it reaches the pressure threshold,
+ * for callers that size their allocations to the budget. */
+VkDeviceSize memoryHeapHeadroom(const MemoryTracker *tracker, uint32_t heap) {
+    VkDeviceSize limit = (VkDeviceSize) (tracker->pressureThreshold * tracker->heapBudget[heap]);
+    return limit > tracker->heapUsage[heap] ? limit - tracker->heapUsage[heap] : 0;
+}
+
+void printMemoryStats(const MemoryTracker *tracker) {
+    for (uint32_t i = 0; i < tracker->properties.memoryHeapCount; ++i) {
+        printf("INFO memory: heap %u%s: %.1f / %.1f MiB (%.1f%% of budget, %.1f MiB allocated by app)\n", i,
+               tracker->properties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT ? " (device local)" : "",
+               tracker->heapUsage[i] / MEBIBYTE, tracker->heapBudget[i] / MEBIBYTE,
+               tracker->heapBudget[i] > 0 ? 100.0 * tracker->heapUsage[i] / tracker->heapBudget[i] : 0.0,
+               tracker->heapAllocated[i] / MEBIBYTE);
+    }
+    printf("INFO memory:");
+    for (uint32_t c = 0; c < MEMORY_CATEGORY_COUNT; ++c) {
+        printf(" %s %.1f MiB (peak %.1f)%s", memoryCategoryNames[c], tracker->categoryAllocated[c] / MEBIBYTE,
+               tracker->categoryPeak[c] / MEBIBYTE, c + 1 < MEMORY_CATEGORY_COUNT ? "," : "\n");
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <vulkan/vulkan.h>
+
+/* Fraction of a heap size assumed to be usable when VK_EXT_memory_budget is not available. */
+#define MEMORY_FALLBACK_BUDGET 0.8f
+#define MEMORY_DEFAULT_PRESSURE_THRESHOLD 0.9f
+
+typedef enum {
+    MEMORY_CATEGORY_BUFFER,
+    MEMORY_CATEGORY_IMAGE,
+    MEMORY_CATEGORY_STAGING,
+    MEMORY_CATEGORY_SWAPCHAIN,
+    MEMORY_CATEGORY_COUNT
+} MemoryCategory;
+
+typedef void (*MemoryPressureCallback)(uint32_t heapIndex, VkDeviceSize usage, VkDeviceSize budget, void *userData);
+
+typedef struct {
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    uint32_t heapIndex;
+    MemoryCategory category;
+} TrackedAllocation;
+
+/* heapUsage is queried from the driver by updateMemoryBudget only. In between it follows the
+ * app's own allocations: heapBaseline is the usage by everything else, as of the last query. */
+typedef struct {
+    VkPhysicalDevice physicalDevice;
+    VkPhysicalDeviceMemoryProperties properties;
+    bool budgetExtension;
+    VkDeviceSize heapBudget[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize heapUsage[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize heapAllocated[VK_MAX_MEMORY_HEAPS];
+    int64_t heapBaseline[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize categoryAllocated[MEMORY_CATEGORY_COUNT];
+    VkDeviceSize categoryPeak[MEMORY_CATEGORY_COUNT];
+    VkDeviceSize swapchainEstimate;
+    uint32_t swapchainHeap;
+    TrackedAllocation *allocations;
+    uint32_t allocationCount;
+    uint32_t allocationCapacity;
+    float pressureThreshold;
+    bool underPressure[VK_MAX_MEMORY_HEAPS];
+    MemoryPressureCallback pressureCallback;
+    void *pressureUserData;
+} MemoryTracker;
+
+extern const char *const memoryCategoryNames[MEMORY_CATEGORY_COUNT];
+
+void createMemoryTracker(VkPhysicalDevice physicalDevice, bool budgetExtension, MemoryTracker *tracker);
+void destroyMemoryTracker(MemoryTracker *tracker);
+void setMemoryPressureCallback(MemoryTracker *tracker, float threshold, MemoryPressureCallback callback, void *userData);
+VkResult allocateTrackedMemory(MemoryTracker *tracker, VkDevice device, const VkMemoryAllocateInfo *allocInfo,
+                               MemoryCategory category, VkDeviceMemory *memory);
+void freeTrackedMemory(MemoryTracker *tracker, VkDevice device, VkDeviceMemory memory);
+void setSwapchainMemoryEstimate(MemoryTracker *tracker, VkDeviceSize size);
+void updateMemoryBudget(MemoryTracker *tracker);
+uint32_t findMemoryHeap(const MemoryTracker *tracker, VkMemoryPropertyFlags properties);
+bool memoryHeapUnderPressure(const MemoryTracker *tracker, uint32_t heap);
+VkDeviceSize memoryHeapHeadroom(const MemoryTracker *tracker, uint32_t heap);
+void printMemoryStats(const MemoryTracker *tracker);
+
+#endif
@@ -0,0 +1,516 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mesh.h"
+
+/* Simulated LRU cache size used by the vertex cache optimizer (Tom Forsyth, "Linear-Speed
+ * Vertex Cache Optimisation"). Larger than MESH_CACHE_SIZE so that the result also holds up
+ * on hardware with bigger post-transform caches. */
+#define OPTIMIZER_CACHE_SIZE 32
+
+static float vertexCacheScore(int cachePosition, uint32_t remainingTriangles) {
+    if (remainingTriangles == 0) {
+        return -1.0f;
+    }
+    float score = 0.0f;
+    if (cachePosition >= 0) {
+        if (cachePosition < 3) {
+            score = 0.75f;
+        } else {
+            float scale = 1.0f / (OPTIMIZER_CACHE_SIZE - 3);
+            score = powf(1.0f - (cachePosition - 3) * scale, 1.5f);
+        }
+    }
+    return score + 2.0f / sqrtf((float) remainingTriangles);
+}
+
+void meshOptimizeVertexCache(uint32_t *indices, uint32_t indexCount, uint32_t vertexCount) {
+    uint32_t triangleCount = indexCount / 3;
+    if (triangleCount == 0) return;
+    uint32_t *adjacencyOffsets = (uint32_t *) calloc(vertexCount + 1, sizeof(uint32_t));
+    uint32_t *remaining = (uint32_t *) calloc(vertexCount, sizeof(uint32_t));
+    uint32_t *adjacency = (uint32_t *) malloc(indexCount * sizeof(uint32_t));
+    int *cachePosition = (int *) malloc(vertexCount * sizeof(int));
+    float *vertexScore = (float *) malloc(vertexCount * sizeof(float));
+    float *triangleScore = (float *) malloc(triangleCount * sizeof(float));
+    bool *emitted = (bool *) calloc(triangleCount, sizeof(bool));
+    uint32_t *output = (uint32_t *) malloc(indexCount * sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < indexCount; ++i) {
+        remaining[indices[i]]++;
+    }
+    for (uint32_t v = 0; v < vertexCount; ++v) {
+        adjacencyOffsets[v + 1] = adjacencyOffsets[v] + remaining[v];
+        cachePosition[v] = -1;
+        vertexScore[v] = vertexCacheScore(-1, remaining[v]);
+    }
+    uint32_t *fill = (uint32_t *) malloc(vertexCount * sizeof(uint32_t));
+    memcpy(fill, adjacencyOffsets, vertexCount * sizeof(uint32_t));
+    for (uint32_t t = 0; t < triangleCount; ++t) {
+        for (uint32_t k = 0; k < 3; ++k) {
+            adjacency[fill[indices[3 * t + k]]++] = t;
+        }
+    }
+    free(fill);
+
+    int64_t best = -1;
+    float bestScore = -1.0f;
+    for (uint32_t t = 0; t < triangleCount; ++t) {
+        triangleScore[t] = vertexScore[indices[3 * t]] + vertexScore[indices[3 * t + 1]] + vertexScore[indices[3 * t + 2]];
+        if (triangleScore[t] > bestScore) {
+            bestScore = triangleScore[t];
+            best = t;
+        }
+    }
+
+    uint32_t cache[OPTIMIZER_CACHE_SIZE + 3];
+    uint32_t cacheCount = 0;
+    uint32_t cursor = 0;
+    for (uint32_t emittedCount = 0; emittedCount < triangleCount; ++emittedCount) {
+        if (best < 0) {
+            while (emitted[cursor]) ++cursor;
+            best = cursor;
+        }
+        uint32_t triangle = (uint32_t) best;
+        const uint32_t *corners = &indices[3 * triangle];
+        memcpy(&output[3 * emittedCount], corners, 3 * sizeof(uint32_t));
+        emitted[triangle] = true;
+
+        for (uint32_t k = 0; k < 3; ++k) {
+            uint32_t v = corners[k];
+            uint32_t *list = &adjacency[adjacencyOffsets[v]];
+            for (uint32_t j = 0; j < remaining[v]; ++j) {
+                if (list[j] == triangle) {
+                    list[j] = list[remaining[v] - 1];
+                    break;
+                }
+            }
+            remaining[v]--;
+        }
+
+        uint32_t newCache[OPTIMIZER_CACHE_SIZE + 6];
+        uint32_t newCount = 0;
+        for (uint32_t k = 0; k < 3; ++k) {
+            newCache[newCount++] = corners[k];
+        }
+        for (uint32_t j = 0; j < cacheCount; ++j) {
+            uint32_t v = cache[j];
+            if (v != corners[0] && v != corners[1] && v != corners[2]) {
+                newCache[newCount++] = v;
+            }
+        }
+
+        best = -1;
+        bestScore = -1.0f;
+        for (uint32_t j = 0; j < newCount; ++j) {
+            uint32_t v = newCache[j];
+            cachePosition[v] = j < OPTIMIZER_CACHE_SIZE ? (int) j : -1;
+            float score = vertexCacheScore(cachePosition[v], remaining[v]);
+            float delta = score - vertexScore[v];
+            vertexScore[v] = score;
+            const uint32_t *list = &adjacency[adjacencyOffsets[v]];
+            for (uint32_t a = 0; a < remaining[v]; ++a) {
+                triangleScore[list[a]] += delta;
+                if (triangleScore[list[a]] > bestScore) {
+                    bestScore = triangleScore[list[a]];
+                    best = list[a];
+                }
+            }
+        }
+        cacheCount = newCount < OPTIMIZER_CACHE_SIZE ? newCount : OPTIMIZER_CACHE_SIZE;
+        memcpy(cache, newCache, cacheCount * sizeof(uint32_t));
+    }
+
+    memcpy(indices, output, triangleCount * 3 * sizeof(uint32_t));
+    free(output);
+    free(emitted);
+    free(triangleScore);
+    free(vertexScore);
+    free(cachePosition);
+    free(adjacency);
+    free(remaining);
+    free(adjacencyOffsets);
+}
+
+void meshOptimizeVertexFetch(MeshData *mesh) {
+    uint32_t *remap = (uint32_t *) malloc(mesh->vertexCount * sizeof(uint32_t));
+    memset(remap, 0xff, mesh->vertexCount * sizeof(uint32_t));
+    MeshVertex *vertices = (MeshVertex *) malloc(mesh->vertexCount * sizeof(MeshVertex));
+    uint32_t next = 0;
+    for (uint32_t i = 0; i < mesh->indexCount; ++i) {
+        uint32_t v = mesh->indices[i];
+        if (remap[v] == UINT32_MAX) {
+            remap[v] = next;
+            vertices[next++] = mesh->vertices[v];
+        }
+        mesh->indices[i] = remap[v];
+    }
+    free(mesh->vertices);
+    free(remap);
+    mesh->vertices = vertices;
+    mesh->vertexCount = next;
+}
+
+typedef struct {
+    uint64_t *keys;
+    uint32_t *values;
+    uint32_t mask;
+} CellMap;
+
+static uint32_t findCell(CellMap *map, uint64_t key, uint32_t *cellCount) {
+    uint64_t h = key * 0x9e3779b97f4a7c15ull;
+    uint32_t slot = (uint32_t) (h >> 32) & map->mask;
+    while (map->values[slot] != UINT32_MAX && map->keys[slot] != key) {
+        slot = (slot + 1) & map->mask;
+    }
+    if (map->values[slot] == UINT32_MAX) {
+        map->keys[slot] = key;
+        map->values[slot] = (*cellCount)++;
+    }
+    return map->values[slot];
+}
+
+/* Vertex clustering: every vertex snaps to the vertex closest to the mean of its grid cell.
+ * Representatives are existing vertices, so all LODs can share one vertex buffer. Returns the
+ * number of indices written; error receives the largest distance a vertex was moved. */
+uint32_t meshSimplify(const MeshData *mesh, const uint32_t *indices, uint32_t indexCount, float cellSize, uint32_t *destination, float *error) {
+    uint32_t vertexCount = mesh->vertexCount;
+    float boundsMin[3] = {INFINITY, INFINITY, INFINITY};
+    for (uint32_t i = 0; i < vertexCount; ++i) {
+        for (uint32_t k = 0; k < 3; ++k) {
+            if (mesh->vertices[i].position[k] < boundsMin[k]) boundsMin[k] = mesh->vertices[i].position[k];
+        }
+    }
+    CellMap map;
+    map.mask = 1;
+    while (map.mask < vertexCount * 2) map.mask *= 2;
+    map.keys = (uint64_t *) malloc(map.mask * sizeof(uint64_t));
+    map.values = (uint32_t *) malloc(map.mask * sizeof(uint32_t));
+    memset(map.values, 0xff, map.mask * sizeof(uint32_t));
+    map.mask -= 1;
+
+    uint32_t *vertexCell = (uint32_t *) malloc(vertexCount * sizeof(uint32_t));
+    float *cellSum = (float *) calloc((size_t) vertexCount * 4, sizeof(float));
+    uint32_t cellCount = 0;
+    for (uint32_t i = 0; i < vertexCount; ++i) {
+        const float *p = mesh->vertices[i].position;
+        uint64_t key = 0;
+        for (uint32_t k = 0; k < 3; ++k) {
+            key = (key << 21) | ((uint64_t) ((p[k] - boundsMin[k]) / cellSize) & 0x1fffff);
+        }
+        uint32_t cell = findCell(&map, key, &cellCount);
+        vertexCell[i] = cell;
+        cellSum[4 * cell] += p[0];
+        cellSum[4 * cell + 1] += p[1];
+        cellSum[4 * cell + 2] += p[2];
+        cellSum[4 * cell + 3] += 1.0f;
+    }
+
+    uint32_t *representative = (uint32_t *) malloc(cellCount * sizeof(uint32_t));
+    float *representativeDistance = (float *) malloc(cellCount * sizeof(float));
+    for (uint32_t c = 0; c < cellCount; ++c) {
+        representativeDistance[c] = INFINITY;
+    }
+    for (uint32_t i = 0; i < vertexCount; ++i) {
+        uint32_t cell = vertexCell[i];
+        const float *sum = &cellSum[4 * cell];
+        const float *p = mesh->vertices[i].position;
+        float dx = p[0] - sum[0] / sum[3];
+        float dy = p[1] - sum[1] / sum[3];
+        float dz = p[2] - sum[2] / sum[3];
+        float distance = dx * dx + dy * dy + dz * dz;
+        if (distance < representativeDistance[cell]) {
+            representativeDistance[cell] = distance;
+            representative[cell] = i;
+        }
+    }
+
+    float maxError = 0.0f;
+    for (uint32_t i = 0; i < vertexCount; ++i) {
+        const float *p = mesh->vertices[i].position;
+        const float *r = mesh->vertices[representative[vertexCell[i]]].position;
+        float distance = sqrtf((p[0] - r[0]) * (p[0] - r[0]) + (p[1] - r[1]) * (p[1] - r[1]) + (p[2] - r[2]) * (p[2] - r[2]));
+        if (distance > maxError) maxError = distance;
+    }
+    *error = maxError;
+
+    uint32_t count = 0;
+    for (uint32_t i = 0; i + 2 < indexCount; i += 3) {
+        uint32_t a = representative[vertexCell[indices[i]]];
+        uint32_t b = representative[vertexCell[indices[i + 1]]];
+        uint32_t c = representative[vertexCell[indices[i + 2]]];
+        if (a != b && b != c && a != c) {
+            destination[count++] = a;
+            destination[count++] = b;
+            destination[count++] = c;
+        }
+    }
+
+    free(representativeDistance);
+    free(representative);
+    free(cellSum);
+    free(vertexCell);
+    free(map.values);
+    free(map.keys);
+    return count;
+}
+
+/* Appends a chain of simplified index lists behind the full resolution one. Each LOD keeps
+ * at most half the triangles of the previous level. */
+void meshBuildLods(MeshData *mesh) {
+    uint32_t baseIndexCount = mesh->lodCount > 0 ? mesh->lods[0].indexCount : mesh->indexCount;
+    mesh->lodCount = 1;
+    mesh->lods[0].indexOffset = 0;
+    mesh->lods[0].indexCount = baseIndexCount;
+    mesh->lods[0].error = 0.0f;
+    mesh->indexCount = baseIndexCount;
+    if (mesh->vertexCount == 0) return;
+
+    float boundsMin[3], boundsMax[3];
+    memcpy(boundsMin, mesh->vertices[0].position, sizeof(boundsMin));
+    memcpy(boundsMax, mesh->vertices[0].position, sizeof(boundsMax));
+    for (uint32_t i = 0; i < mesh->vertexCount; ++i) {
+        for (uint32_t k = 0; k < 3; ++k) {
+            float p = mesh->vertices[i].position[k];
+            if (p < boundsMin[k]) boundsMin[k] = p;
+            if (p > boundsMax[k]) boundsMax[k] = p;
+        }
+    }
+    float diagonal = sqrtf((boundsMax[0] - boundsMin[0]) * (boundsMax[0] - boundsMin[0])
+                         + (boundsMax[1] - boundsMin[1]) * (boundsMax[1] - boundsMin[1])
+                         + (boundsMax[2] - boundsMin[2]) * (boundsMax[2] - boundsMin[2]));
+
+    uint32_t *scratch = (uint32_t *) malloc(baseIndexCount * sizeof(uint32_t));
+    uint32_t previousIndexCount = baseIndexCount;
+    for (float cellSize = diagonal / 256.0f; cellSize < diagonal && mesh->lodCount < MESH_MAX_LODS; cellSize *= 1.5f) {
+        float error;
+        uint32_t count = meshSimplify(mesh, mesh->indices, baseIndexCount, cellSize, scratch, &error);
+        if (count == 0) break;
+        if (count * 2 > previousIndexCount) continue;
+        meshOptimizeVertexCache(scratch, count, mesh->vertexCount);
+        mesh->indices = (uint32_t *) realloc(mesh->indices, (mesh->indexCount + count) * sizeof(uint32_t));
+        memcpy(mesh->indices + mesh->indexCount, scratch, count * sizeof(uint32_t));
+        MeshLod *lod = &mesh->lods[mesh->lodCount++];
+        lod->indexOffset = mesh->indexCount;
+        lod->indexCount = count;
+        // a coarser grid can shift the cells so that the largest move shrinks, but the
+        // selector counts the LODs that pass its test and relies on non-decreasing errors
+        lod->error = fmaxf(error, mesh->lods[mesh->lodCount - 2].error);
+        lod->reserved = 0;
+        mesh->indexCount += count;
+        previousIndexCount = count;
+        if (count < 3 * 32) break;
+    }
+    free(scratch);
+}
+
+float meshComputeAcmr(const uint32_t *indices, uint32_t indexCount, uint32_t vertexCount, uint32_t cacheSize) {
+    if (indexCount < 3) return 0.0f;
+    uint32_t *timestamps = (uint32_t *) calloc(vertexCount, sizeof(uint32_t));
+    uint32_t time = cacheSize + 1;
+    uint32_t misses = 0;
+    for (uint32_t i = 0; i < indexCount; ++i) {
+        uint32_t v = indices[i];
+        if (time - timestamps[v] > cacheSize) {
+            timestamps[v] = time++;
+            misses++;
+        }
+    }
+    free(timestamps);
+    return (float) misses / (float) (indexCount / 3);
+}
+
+uint32_t meshIndexSize(uint32_t vertexCount) {
+    return vertexCount <= UINT16_MAX + 1u ? 2 : 4;
+}
+
+size_t meshFileSize(uint32_t vertexCount, uint32_t indexCount) {
+    size_t indexSize = meshIndexSize(vertexCount);
+    size_t vertexBytes = (size_t) vertexCount * sizeof(PackedVertex);
+    size_t indexOffset = (sizeof(MeshFileHeader) + vertexBytes + 3) & ~(size_t) 3;
+    return indexOffset + indexCount * indexSize;
+}
+
+static uint16_t floatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000u;
+    int32_t exponent = (int32_t) ((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffffu;
+    if (((bits >> 23) & 0xff) == 0xff) {
+        return (uint16_t) (sign | 0x7c00u | (mantissa ? 0x200u : 0));
+    }
+    if (exponent >= 31) {
+        return (uint16_t) (sign | 0x7c00u);
+    }
+    if (exponent <= 0) {
+        if (exponent < -10) return (uint16_t) sign;
+        mantissa |= 0x800000u;
+        uint32_t shift = (uint32_t) (14 - exponent);
+        uint32_t half = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1u) half++;
+        return (uint16_t) (sign | half);
+    }
+    uint32_t half = sign | ((uint32_t) exponent << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000u) half++;
+    return (uint16_t) half;
+}
+
+static int16_t floatToSnorm16(float value) {
+    if (value > 1.0f) value = 1.0f;
+    if (value < -1.0f) value = -1.0f;
+    return (int16_t) lrintf(value * 32767.0f);
+}
+
+void packVertex(const MeshVertex *vertex, PackedVertex *packed) {
+    memcpy(packed->position, vertex->position, sizeof(packed->position));
+    float x = vertex->normal[0];
+    float y = vertex->normal[1];
+    float z = vertex->normal[2];
+    float length = fabsf(x) + fabsf(y) + fabsf(z);
+    if (length > 0.0f) {
+        x /= length;
+        y /= length;
+        z /= length;
+    } else {
+        z = 1.0f;
+    }
+    if (z < 0.0f) {
+        float ox = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float oy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = ox;
+        y = oy;
+    }
+    packed->normal[0] = floatToSnorm16(x);
+    packed->normal[1] = floatToSnorm16(y);
+    packed->uv[0] = floatToHalf(vertex->uv[0]);
+    packed->uv[1] = floatToHalf(vertex->uv[1]);
+}
+
+bool writeMeshFile(const char filename[], const MeshData *mesh) {
+    MeshFileHeader header = {};
+    header.magic = MESH_FILE_MAGIC;
+    header.version = MESH_FILE_VERSION;
+    header.vertexCount = mesh->vertexCount;
+    header.vertexStride = sizeof(PackedVertex);
+    header.indexCount = mesh->indexCount;
+    header.indexSize = meshIndexSize(mesh->vertexCount);
+    header.vertexOffset = sizeof(MeshFileHeader);
+    if (mesh->lodCount > 0) {
+        header.lodCount = mesh->lodCount;
+        memcpy(header.lods, mesh->lods, mesh->lodCount * sizeof(MeshLod));
+    } else {
+        header.lodCount = 1;
+        header.lods[0].indexCount = mesh->indexCount;
+    }
+    header.indexOffset = (header.vertexOffset + (uint64_t) mesh->vertexCount * sizeof(PackedVertex) + 3) & ~(uint64_t) 3;
+    for (uint32_t k = 0; k < 3; ++k) {
+        header.boundsMin[k] = mesh->vertexCount > 0 ? mesh->vertices[0].position[k] : 0.0f;
+        header.boundsMax[k] = header.boundsMin[k];
+    }
+    for (uint32_t i = 0; i < mesh->vertexCount; ++i) {
+        for (uint32_t k = 0; k < 3; ++k) {
+            float p = mesh->vertices[i].position[k];
+            if (p < header.boundsMin[k]) header.boundsMin[k] = p;
+            if (p > header.boundsMax[k]) header.boundsMax[k] = p;
+        }
+    }
+
+    size_t fileSize = meshFileSize(mesh->vertexCount, mesh->indexCount);
+    unsigned char *buffer = (unsigned char *) calloc(fileSize, 1);
+    memcpy(buffer, &header, sizeof(header));
+    PackedVertex *vertices = (PackedVertex *) (buffer + header.vertexOffset);
+    for (uint32_t i = 0; i < mesh->vertexCount; ++i) {
+        packVertex(&mesh->vertices[i], &vertices[i]);
+    }
+    if (header.indexSize == 2) {
+        uint16_t *indices = (uint16_t *) (buffer + header.indexOffset);
+        for (uint32_t i = 0; i < mesh->indexCount; ++i) {
+            indices[i] = (uint16_t) mesh->indices[i];
+        }
+    } else {
+        memcpy(buffer + header.indexOffset, mesh->indices, mesh->indexCount * sizeof(uint32_t));
+    }
+
+    FILE *fp = fopen(filename, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR opening file: %s\n", filename);
+        free(buffer);
+        return false;
+    }
+    bool success = fwrite(buffer, 1, fileSize, fp) == fileSize;
+    if (!success) {
+        fprintf(stderr, "ERROR writing file: %s\n", filename);
+    }
+    fclose(fp);
+    free(buffer);
+    return success;
+}
+
+bool mapMeshFile(const char filename[], MappedMesh *mapped) {
+    memset(mapped, 0, sizeof(*mapped));
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR opening file: %s\n", filename);
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(MeshFileHeader)) {
+        fprintf(stderr, "ERROR reading file: %s\n", filename);
+        close(fd);
+        return false;
+    }
+    void *base = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "ERROR mapping file: %s\n", filename);
+        return false;
+    }
+    const MeshFileHeader *header = (const MeshFileHeader *) base;
+    uint64_t indexEnd = header->indexOffset + (uint64_t) header->indexCount * header->indexSize;
+    uint64_t vertexEnd = header->vertexOffset + (uint64_t) header->vertexCount * header->vertexStride;
+    if (header->magic != MESH_FILE_MAGIC || header->version != MESH_FILE_VERSION
+        || header->vertexStride != sizeof(PackedVertex)
+        || (header->indexSize != 2 && header->indexSize != 4)
+        || header->lodCount == 0 || header->lodCount > MESH_MAX_LODS
+        || vertexEnd > (uint64_t) info.st_size || indexEnd > (uint64_t) info.st_size) {
+        fprintf(stderr, "ERROR invalid mesh file: %s\n", filename);
+        munmap(base, (size_t) info.st_size);
+        return false;
+    }
+    for (uint32_t i = 0; i < header->lodCount; ++i) {
+        if ((uint64_t) header->lods[i].indexOffset + header->lods[i].indexCount > header->indexCount
+            || !(header->lods[i].error >= (i > 0 ? header->lods[i - 1].error : 0.0f))) {
+            fprintf(stderr, "ERROR invalid mesh file: %s\n", filename);
+            munmap(base, (size_t) info.st_size);
+            return false;
+        }
+    }
+    mapped->base = base;
+    mapped->size = (size_t) info.st_size;
+    mapped->header = header;
+    mapped->vertices = (const PackedVertex *) ((const char *) base + header->vertexOffset);
+    mapped->indices = (const char *) base + header->indexOffset;
+    return true;
+}
+
+void unmapMeshFile(MappedMesh *mapped) {
+    if (mapped->base != NULL) {
+        munmap(mapped->base, mapped->size);
+    }
+    memset(mapped, 0, sizeof(*mapped));
+}
+
+void meshDestroy(MeshData *mesh) {
+    free(mesh->vertices);
+    free(mesh->indices);
+    memset(mesh, 0, sizeof(*mesh));
+}
@@ -0,0 +1,92 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define MESH_FILE_MAGIC 0x48534d56u /* "VMSH" little endian */
+#define MESH_FILE_VERSION 2
+#define MESH_CACHE_SIZE 16
+#define MESH_MAX_LODS 8
+
+/* Unquantized vertex as produced by the importers. */
+typedef struct {
+    float position[3];
+    float normal[3];
+    float uv[2];
+} MeshVertex;
+
+/* Vertex layout of the binary mesh file, consumed directly by the vertex shader:
+ * position as R32G32B32_SFLOAT, octahedral normal as R16G16_SNORM, uv as R16G16_SFLOAT. */
+typedef struct {
+    float position[3];
+    int16_t normal[2];
+    uint16_t uv[2];
+} PackedVertex;
+
+/* Range of the shared index buffer belonging to one level of detail. error is the maximum
+ * object-space distance a vertex moved during simplification, 0 for the full mesh and never
+ * below the error of the previous LOD. */
+typedef struct {
+    uint32_t indexOffset;
+    uint32_t indexCount;
+    float error;
+    uint32_t reserved;
+} MeshLod;
+
+/* All LODs share the vertex array; indices holds the index lists of all LODs back to back. */
+typedef struct {
+    MeshVertex *vertices;
+    uint32_t vertexCount;
+    uint32_t *indices;
+    uint32_t indexCount;
+    MeshLod lods[MESH_MAX_LODS];
+    uint32_t lodCount;
+} MeshData;
+
+/* On-disk header; vertex and index data follow at the given offsets so the file
+ * can be mapped and handed to the GPU upload without any parsing. */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vertexCount;
+    uint32_t vertexStride;
+    uint32_t indexCount;
+    uint32_t indexSize;
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    float boundsMin[3];
+    float boundsMax[3];
+    uint32_t lodCount;
+    uint32_t reserved;
+    MeshLod lods[MESH_MAX_LODS];
+} MeshFileHeader;
+
+typedef struct {
+    void *base;
+    size_t size;
+    const MeshFileHeader *header;
+    const PackedVertex *vertices;
+    const void *indices;
+} MappedMesh;
+
+bool meshImport(const char filename[], MeshData *mesh);
+bool meshImportObj(const char filename[], MeshData *mesh);
+bool meshImportGltf(const char filename[], MeshData *mesh);
+void meshDestroy(MeshData *mesh);
+
+void meshOptimizeVertexCache(uint32_t *indices, uint32_t indexCount, uint32_t vertexCount);
+void meshOptimizeVertexFetch(MeshData *mesh);
+uint32_t meshSimplify(const MeshData *mesh, const uint32_t *indices, uint32_t indexCount, float cellSize, uint32_t *destination, float *error);
+void meshBuildLods(MeshData *mesh);
+float meshComputeAcmr(const uint32_t *indices, uint32_t indexCount, uint32_t vertexCount, uint32_t cacheSize);
+uint32_t meshIndexSize(uint32_t vertexCount);
+size_t meshFileSize(uint32_t vertexCount, uint32_t indexCount);
+
+void packVertex(const MeshVertex *vertex, PackedVertex *packed);
+bool writeMeshFile(const char filename[], const MeshData *mesh);
+bool mapMeshFile(const char filename[], MappedMesh *mapped);
+void unmapMeshFile(MappedMesh *mapped);
+
+#endif
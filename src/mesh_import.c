@@ -0,0 +1,593 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "mesh.h"
+
+static char *readFile(const char filename[], size_t *size) {
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR opening file: %s\n", filename);
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    size_t filesize = ftell(fp);
+    rewind(fp);
+    char *buffer = (char *) malloc(filesize + 1);
+    if (fread(buffer, 1, filesize, fp) != filesize) {
+        fprintf(stderr, "ERROR reading file: %s\n", filename);
+        free(buffer);
+        fclose(fp);
+        return NULL;
+    }
+    buffer[filesize] = '\0';
+    fclose(fp);
+    *size = filesize;
+    return buffer;
+}
+
+static bool hasExtension(const char filename[], const char extension[]) {
+    size_t length = strlen(filename);
+    size_t extensionLength = strlen(extension);
+    if (length < extensionLength) return false;
+    const char *suffix = filename + length - extensionLength;
+    for (size_t i = 0; i < extensionLength; ++i) {
+        if (tolower((unsigned char) suffix[i]) != extension[i]) return false;
+    }
+    return true;
+}
+
+bool meshImport(const char filename[], MeshData *mesh) {
+    if (hasExtension(filename, ".obj")) {
+        return meshImportObj(filename, mesh);
+    }
+    if (hasExtension(filename, ".gltf") || hasExtension(filename, ".glb")) {
+        return meshImportGltf(filename, mesh);
+    }
+    fprintf(stderr, "ERROR unsupported mesh format: %s\n", filename);
+    return false;
+}
+
+/* Accumulates area weighted face normals for the vertices firstVertex to vertexEnd, from the
+ * triangles firstIndex to indexEnd, which must only reference those vertices. With missing
+ * set, only the vertices flagged in it get a normal, the others keep theirs. */
+static void generateNormals(MeshData *mesh, uint32_t firstVertex, uint32_t vertexEnd, uint32_t firstIndex, uint32_t indexEnd,
+                            const bool *missing) {
+    for (uint32_t i = firstVertex; i < vertexEnd; ++i) {
+        if (missing == NULL || missing[i]) memset(mesh->vertices[i].normal, 0, sizeof(mesh->vertices[i].normal));
+    }
+    for (uint32_t i = firstIndex; i + 2 < indexEnd; i += 3) {
+        const uint32_t *corner = &mesh->indices[i];
+        const float *a = mesh->vertices[corner[0]].position;
+        const float *b = mesh->vertices[corner[1]].position;
+        const float *c = mesh->vertices[corner[2]].position;
+        float e1[3], e2[3];
+        for (uint32_t k = 0; k < 3; ++k) {
+            e1[k] = b[k] - a[k];
+            e2[k] = c[k] - a[k];
+        }
+        float n[3] = {
+            e1[1] * e2[2] - e1[2] * e2[1],
+            e1[2] * e2[0] - e1[0] * e2[2],
+            e1[0] * e2[1] - e1[1] * e2[0]
+        };
+        for (uint32_t j = 0; j < 3; ++j) {
+            if (missing != NULL && !missing[corner[j]]) continue;
+            float *normal = mesh->vertices[corner[j]].normal;
+            normal[0] += n[0];
+            normal[1] += n[1];
+            normal[2] += n[2];
+        }
+    }
+    for (uint32_t i = firstVertex; i < vertexEnd; ++i) {
+        if (missing != NULL && !missing[i]) continue;
+        float *n = mesh->vertices[i].normal;
+        float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (length > 0.0f) {
+            n[0] /= length;
+            n[1] /= length;
+            n[2] /= length;
+        } else {
+            n[2] = 1.0f;
+        }
+    }
+}
+
+/* ------------------------------------------------------------------------- OBJ */
+
+typedef struct {
+    int32_t position;
+    int32_t uv;
+    int32_t normal;
+} ObjCorner;
+
+typedef struct {
+    ObjCorner *keys;
+    uint32_t *values;
+    uint32_t capacity;
+} CornerMap;
+
+static uint32_t hashCorner(ObjCorner corner) {
+    uint32_t h = (uint32_t) corner.position * 73856093u;
+    h ^= (uint32_t) corner.uv * 19349663u;
+    h ^= (uint32_t) corner.normal * 83492791u;
+    return h;
+}
+
+static void growArray(void **array, uint32_t *capacity, uint32_t count, size_t elementSize) {
+    if (count < *capacity) return;
+    *capacity = *capacity ? *capacity * 2 : 1024;
+    *array = realloc(*array, *capacity * elementSize);
+}
+
+static int32_t resolveObjIndex(long index, uint32_t count) {
+    if (index > 0) return (int32_t) index - 1;
+    if (index < 0) return (int32_t) count + (int32_t) index;
+    return -1;
+}
+
+bool meshImportObj(const char filename[], MeshData *mesh) {
+    size_t size;
+    char *text = readFile(filename, &size);
+    if (text == NULL) return false;
+    memset(mesh, 0, sizeof(*mesh));
+
+    float *positions = NULL, *uvs = NULL, *normals = NULL;
+    uint32_t positionCount = 0, uvCount = 0, normalCount = 0;
+    uint32_t positionCapacity = 0, uvCapacity = 0, normalCapacity = 0;
+    ObjCorner *corners = NULL;
+    uint32_t cornerCount = 0, cornerCapacity = 0;
+    ObjCorner *polygon = NULL;
+    uint32_t polygonCapacity = 0;
+    bool success = true;
+
+    char *line = text;
+    while (line != NULL && *line != '\0') {
+        char *next = strchr(line, '\n');
+        if (next != NULL) *next++ = '\0';
+        while (*line == ' ' || *line == '\t') ++line;
+        if (line[0] == 'v' && line[1] == ' ') {
+            growArray((void **) &positions, &positionCapacity, positionCount, 3 * sizeof(float));
+            float *p = &positions[3 * positionCount++];
+            p[0] = p[1] = p[2] = 0.0f;
+            sscanf(line + 2, "%f %f %f", &p[0], &p[1], &p[2]);
+        } else if (line[0] == 'v' && line[1] == 't') {
+            growArray((void **) &uvs, &uvCapacity, uvCount, 2 * sizeof(float));
+            float *t = &uvs[2 * uvCount++];
+            t[0] = t[1] = 0.0f;
+            sscanf(line + 2, "%f %f", &t[0], &t[1]);
+            t[1] = 1.0f - t[1];
+        } else if (line[0] == 'v' && line[1] == 'n') {
+            growArray((void **) &normals, &normalCapacity, normalCount, 3 * sizeof(float));
+            float *n = &normals[3 * normalCount++];
+            n[0] = n[1] = n[2] = 0.0f;
+            sscanf(line + 2, "%f %f %f", &n[0], &n[1], &n[2]);
+        } else if (line[0] == 'f' && line[1] == ' ') {
+            uint32_t polygonSize = 0;
+            char *cursor = line + 2;
+            while (*cursor != '\0') {
+                while (isspace((unsigned char) *cursor)) ++cursor;
+                if (*cursor == '\0') break;
+                ObjCorner corner = {-1, -1, -1};
+                corner.position = resolveObjIndex(strtol(cursor, &cursor, 10), positionCount);
+                if (*cursor == '/') {
+                    ++cursor;
+                    if (*cursor != '/') corner.uv = resolveObjIndex(strtol(cursor, &cursor, 10), uvCount);
+                    if (*cursor == '/') {
+                        ++cursor;
+                        corner.normal = resolveObjIndex(strtol(cursor, &cursor, 10), normalCount);
+                    }
+                }
+                while (*cursor != '\0' && !isspace((unsigned char) *cursor)) ++cursor;
+                if (corner.position < 0 || corner.position >= (int32_t) positionCount
+                    || corner.uv >= (int32_t) uvCount || corner.normal >= (int32_t) normalCount) {
+                    fprintf(stderr, "ERROR invalid face in OBJ file: %s\n", filename);
+                    success = false;
+                    break;
+                }
+                growArray((void **) &polygon, &polygonCapacity, polygonSize, sizeof(ObjCorner));
+                polygon[polygonSize++] = corner;
+            }
+            for (uint32_t i = 1; success && i + 1 < polygonSize; ++i) {
+                growArray((void **) &corners, &cornerCapacity, cornerCount + 2, sizeof(ObjCorner));
+                corners[cornerCount++] = polygon[0];
+                corners[cornerCount++] = polygon[i];
+                corners[cornerCount++] = polygon[i + 1];
+            }
+        }
+        if (!success) break;
+        line = next;
+    }
+
+    if (success && cornerCount > 0) {
+        CornerMap map;
+        map.capacity = 1;
+        while (map.capacity < cornerCount * 2) map.capacity *= 2;
+        map.keys = (ObjCorner *) malloc(map.capacity * sizeof(ObjCorner));
+        map.values = (uint32_t *) malloc(map.capacity * sizeof(uint32_t));
+        memset(map.values, 0xff, map.capacity * sizeof(uint32_t));
+        mesh->vertices = (MeshVertex *) malloc(cornerCount * sizeof(MeshVertex));
+        mesh->indices = (uint32_t *) malloc(cornerCount * sizeof(uint32_t));
+        // corners without a normal index may be mixed with ones that have it
+        bool *missingNormals = (bool *) malloc(cornerCount * sizeof(bool));
+        uint32_t missingCount = 0;
+        for (uint32_t i = 0; i < cornerCount; ++i) {
+            ObjCorner corner = corners[i];
+            uint32_t slot = hashCorner(corner) & (map.capacity - 1);
+            while (map.values[slot] != UINT32_MAX && memcmp(&map.keys[slot], &corner, sizeof(corner)) != 0) {
+                slot = (slot + 1) & (map.capacity - 1);
+            }
+            if (map.values[slot] == UINT32_MAX) {
+                MeshVertex *vertex = &mesh->vertices[mesh->vertexCount];
+                memset(vertex, 0, sizeof(*vertex));
+                memcpy(vertex->position, &positions[3 * corner.position], 3 * sizeof(float));
+                if (corner.uv >= 0) memcpy(vertex->uv, &uvs[2 * corner.uv], 2 * sizeof(float));
+                if (corner.normal >= 0) memcpy(vertex->normal, &normals[3 * corner.normal], 3 * sizeof(float));
+                missingNormals[mesh->vertexCount] = corner.normal < 0;
+                missingCount += corner.normal < 0;
+                map.keys[slot] = corner;
+                map.values[slot] = mesh->vertexCount++;
+            }
+            mesh->indices[mesh->indexCount++] = map.values[slot];
+        }
+        free(map.keys);
+        free(map.values);
+        if (missingCount > 0) {
+            generateNormals(mesh, 0, mesh->vertexCount, 0, mesh->indexCount, missingNormals);
+        }
+        free(missingNormals);
+    } else if (success) {
+        fprintf(stderr, "ERROR no faces in OBJ file: %s\n", filename);
+        success = false;
+    }
+
+    free(polygon);
+    free(corners);
+    free(normals);
+    free(uvs);
+    free(positions);
+    free(text);
+    if (!success) meshDestroy(mesh);
+    return success;
+}
+
+/* ------------------------------------------------------------------------ glTF */
+
+/* Flat token list of a JSON document, each token knows the index just past its subtree. */
+typedef enum {
+    JSON_PRIMITIVE,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT
+} JsonType;
+
+typedef struct {
+    JsonType type;
+    uint32_t start;
+    uint32_t end;
+    uint32_t size;
+    uint32_t next;
+} JsonToken;
+
+typedef struct {
+    const char *text;
+    JsonToken *tokens;
+    uint32_t count;
+    uint32_t capacity;
+} Json;
+
+static void skipWhitespace(const char *text, size_t length, size_t *position) {
+    while (*position < length && isspace((unsigned char) text[*position])) ++*position;
+}
+
+static int64_t parseJsonValue(Json *json, size_t length, size_t *position, uint32_t depth) {
+    const char *text = json->text;
+    skipWhitespace(text, length, position);
+    if (*position >= length || depth > 64) return -1;
+    growArray((void **) &json->tokens, &json->capacity, json->count, sizeof(JsonToken));
+    uint32_t index = json->count++;
+    JsonToken token = {};
+    char c = text[*position];
+    if (c == '{' || c == '[') {
+        token.type = c == '{' ? JSON_OBJECT : JSON_ARRAY;
+        token.start = (uint32_t) (*position)++;
+        char close = c == '{' ? '}' : ']';
+        skipWhitespace(text, length, position);
+        while (*position < length && text[*position] != close) {
+            if (token.type == JSON_OBJECT) {
+                if (parseJsonValue(json, length, position, depth + 1) < 0) return -1;
+                skipWhitespace(text, length, position);
+                if (*position >= length || text[*position] != ':') return -1;
+                ++*position;
+            }
+            if (parseJsonValue(json, length, position, depth + 1) < 0) return -1;
+            token.size++;
+            skipWhitespace(text, length, position);
+            if (*position < length && text[*position] == ',') {
+                ++*position;
+                skipWhitespace(text, length, position);
+            }
+        }
+        if (*position >= length) return -1;
+        ++*position;
+    } else if (c == '"') {
+        token.type = JSON_STRING;
+        token.start = (uint32_t) ++*position;
+        while (*position < length && text[*position] != '"') {
+            if (text[*position] == '\\') ++*position;
+            ++*position;
+        }
+        if (*position >= length) return -1;
+        token.end = (uint32_t) (*position)++;
+    } else {
+        token.type = JSON_PRIMITIVE;
+        token.start = (uint32_t) *position;
+        while (*position < length && !isspace((unsigned char) text[*position])
+               && text[*position] != ',' && text[*position] != ']' && text[*position] != '}') {
+            ++*position;
+        }
+        token.end = (uint32_t) *position;
+    }
+    if (token.type != JSON_STRING && token.type != JSON_PRIMITIVE) {
+        token.end = (uint32_t) *position;
+    }
+    token.next = json->count;
+    json->tokens[index] = token;
+    return index;
+}
+
+static bool jsonStringEquals(const Json *json, uint32_t token, const char string[]) {
+    const JsonToken *t = &json->tokens[token];
+    size_t length = strlen(string);
+    return t->type == JSON_STRING && t->end - t->start == length
+        && strncmp(json->text + t->start, string, length) == 0;
+}
+
+/* Returns the value token for key in the object, or -1. */
+static int64_t jsonFind(const Json *json, int64_t object, const char key[]) {
+    if (object < 0 || json->tokens[object].type != JSON_OBJECT) return -1;
+    uint32_t token = (uint32_t) object + 1;
+    for (uint32_t i = 0; i < json->tokens[object].size; ++i) {
+        uint32_t value = token + 1;
+        if (jsonStringEquals(json, token, key)) return value;
+        token = json->tokens[value].next;
+    }
+    return -1;
+}
+
+static int64_t jsonAt(const Json *json, int64_t array, uint32_t n) {
+    if (array < 0 || json->tokens[array].type != JSON_ARRAY || n >= json->tokens[array].size) return -1;
+    uint32_t token = (uint32_t) array + 1;
+    for (uint32_t i = 0; i < n; ++i) token = json->tokens[token].next;
+    return token;
+}
+
+static int64_t jsonInteger(const Json *json, int64_t token, int64_t fallback) {
+    if (token < 0 || json->tokens[token].type != JSON_PRIMITIVE) return fallback;
+    return strtoll(json->text + json->tokens[token].start, NULL, 10);
+}
+
+typedef struct {
+    unsigned char *data;
+    size_t size;
+} GltfBuffer;
+
+static int base64Value(char c) {
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '+') return 62;
+    if (c == '/') return 63;
+    return -1;
+}
+
+static bool decodeBase64(const char *text, size_t length, GltfBuffer *buffer) {
+    buffer->data = (unsigned char *) malloc(length / 4 * 3 + 3);
+    buffer->size = 0;
+    uint32_t accumulator = 0;
+    int bits = 0;
+    for (size_t i = 0; i < length && text[i] != '='; ++i) {
+        int value = base64Value(text[i]);
+        if (value < 0) return false;
+        accumulator = (accumulator << 6) | (uint32_t) value;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            buffer->data[buffer->size++] = (unsigned char) (accumulator >> bits);
+        }
+    }
+    return true;
+}
+
+static bool loadGltfBuffer(const Json *json, int64_t bufferToken, const char filename[], GltfBuffer *glbChunk, GltfBuffer *buffer) {
+    int64_t uri = jsonFind(json, bufferToken, "uri");
+    if (uri < 0) {
+        if (glbChunk->data == NULL) return false;
+        buffer->data = (unsigned char *) malloc(glbChunk->size);
+        memcpy(buffer->data, glbChunk->data, glbChunk->size);
+        buffer->size = glbChunk->size;
+        return true;
+    }
+    const char *text = json->text + json->tokens[uri].start;
+    size_t length = json->tokens[uri].end - json->tokens[uri].start;
+    if (length > 5 && strncmp(text, "data:", 5) == 0) {
+        const char *comma = memchr(text, ',', length);
+        if (comma == NULL) return false;
+        return decodeBase64(comma + 1, length - (size_t) (comma + 1 - text), buffer);
+    }
+    const char *slash = strrchr(filename, '/');
+    size_t directoryLength = slash ? (size_t) (slash - filename + 1) : 0;
+    char *path = (char *) malloc(directoryLength + length + 1);
+    memcpy(path, filename, directoryLength);
+    memcpy(path + directoryLength, text, length);
+    path[directoryLength + length] = '\0';
+    buffer->data = (unsigned char *) readFile(path, &buffer->size);
+    free(path);
+    return buffer->data != NULL;
+}
+
+enum {
+    GLTF_UNSIGNED_BYTE = 5121,
+    GLTF_UNSIGNED_SHORT = 5123,
+    GLTF_UNSIGNED_INT = 5125,
+    GLTF_FLOAT = 5126
+};
+
+/* Resolves an accessor into a base pointer, element count and byte stride. */
+static bool gltfAccessor(const Json *json, const GltfBuffer *buffers, uint32_t bufferCount, int64_t accessorIndex,
+                         uint32_t expectedComponents, const unsigned char **data, uint32_t *count,
+                         uint32_t *stride, uint32_t *componentType) {
+    int64_t accessor = jsonAt(json, jsonFind(json, 0, "accessors"), (uint32_t) accessorIndex);
+    if (accessor < 0) return false;
+    int64_t view = jsonAt(json, jsonFind(json, 0, "bufferViews"), (uint32_t) jsonInteger(json, jsonFind(json, accessor, "bufferView"), -1));
+    if (view < 0) return false;
+    int64_t bufferIndex = jsonInteger(json, jsonFind(json, view, "buffer"), -1);
+    if (bufferIndex < 0 || bufferIndex >= bufferCount) return false;
+    *componentType = (uint32_t) jsonInteger(json, jsonFind(json, accessor, "componentType"), 0);
+    *count = (uint32_t) jsonInteger(json, jsonFind(json, accessor, "count"), 0);
+    uint32_t componentSize = *componentType == GLTF_UNSIGNED_BYTE ? 1 : *componentType == GLTF_UNSIGNED_SHORT ? 2 : 4;
+    *stride = (uint32_t) jsonInteger(json, jsonFind(json, view, "byteStride"), componentSize * expectedComponents);
+    size_t offset = (size_t) jsonInteger(json, jsonFind(json, view, "byteOffset"), 0)
+                  + (size_t) jsonInteger(json, jsonFind(json, accessor, "byteOffset"), 0);
+    if (*count > 0 && offset + (size_t) (*count - 1) * *stride + componentSize * expectedComponents > buffers[bufferIndex].size) {
+        return false;
+    }
+    *data = buffers[bufferIndex].data + offset;
+    return true;
+}
+
+static bool appendGltfPrimitive(const Json *json, const GltfBuffer *buffers, uint32_t bufferCount,
+                                int64_t primitive, MeshData *mesh) {
+    int64_t mode = jsonInteger(json, jsonFind(json, primitive, "mode"), 4);
+    if (mode != 4) {
+        printf("INFO mesh: skipping non-triangle glTF primitive\n");
+        return true;
+    }
+    int64_t attributes = jsonFind(json, primitive, "attributes");
+    int64_t positionAccessor = jsonInteger(json, jsonFind(json, attributes, "POSITION"), -1);
+    int64_t normalAccessor = jsonInteger(json, jsonFind(json, attributes, "NORMAL"), -1);
+    int64_t uvAccessor = jsonInteger(json, jsonFind(json, attributes, "TEXCOORD_0"), -1);
+    int64_t indexAccessor = jsonInteger(json, jsonFind(json, primitive, "indices"), -1);
+    const unsigned char *positions, *normals = NULL, *uvs = NULL, *indices = NULL;
+    uint32_t count, stride, type, normalStride = 0, uvStride = 0, indexCount, indexStride, indexType = 0;
+    if (!gltfAccessor(json, buffers, bufferCount, positionAccessor, 3, &positions, &count, &stride, &type) || type != GLTF_FLOAT) {
+        return false;
+    }
+    uint32_t attributeCount;
+    if (normalAccessor >= 0 && (!gltfAccessor(json, buffers, bufferCount, normalAccessor, 3, &normals, &attributeCount, &normalStride, &type)
+                                || type != GLTF_FLOAT || attributeCount != count)) {
+        return false;
+    }
+    if (uvAccessor >= 0 && (!gltfAccessor(json, buffers, bufferCount, uvAccessor, 2, &uvs, &attributeCount, &uvStride, &type)
+                            || type != GLTF_FLOAT || attributeCount != count)) {
+        return false;
+    }
+    if (indexAccessor >= 0) {
+        if (!gltfAccessor(json, buffers, bufferCount, indexAccessor, 1, &indices, &indexCount, &indexStride, &indexType)) return false;
+    } else {
+        indexCount = count;
+    }
+    uint32_t baseVertex = mesh->vertexCount;
+    uint32_t baseIndex = mesh->indexCount;
+    mesh->vertices = (MeshVertex *) realloc(mesh->vertices, (mesh->vertexCount + count) * sizeof(MeshVertex));
+    for (uint32_t i = 0; i < count; ++i) {
+        MeshVertex *vertex = &mesh->vertices[mesh->vertexCount++];
+        memset(vertex, 0, sizeof(*vertex));
+        memcpy(vertex->position, positions + (size_t) i * stride, 3 * sizeof(float));
+        if (normals) memcpy(vertex->normal, normals + (size_t) i * normalStride, 3 * sizeof(float));
+        if (uvs) memcpy(vertex->uv, uvs + (size_t) i * uvStride, 2 * sizeof(float));
+    }
+    mesh->indices = (uint32_t *) realloc(mesh->indices, (mesh->indexCount + indexCount) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < indexCount; ++i) {
+        uint32_t index = i;
+        if (indexType == GLTF_UNSIGNED_BYTE) {
+            index = indices[(size_t) i * indexStride];
+        } else if (indexType == GLTF_UNSIGNED_SHORT) {
+            uint16_t value;
+            memcpy(&value, indices + (size_t) i * indexStride, sizeof(value));
+            index = value;
+        } else if (indexType == GLTF_UNSIGNED_INT) {
+            memcpy(&index, indices + (size_t) i * indexStride, sizeof(index));
+        }
+        if (index >= count) return false;
+        mesh->indices[mesh->indexCount++] = baseVertex + index;
+    }
+    mesh->indexCount -= (mesh->indexCount - baseIndex) % 3;
+    // only this primitive, the normals of the others may come from the file
+    if (normals == NULL) {
+        generateNormals(mesh, baseVertex, mesh->vertexCount, baseIndex, mesh->indexCount, NULL);
+    }
+    return true;
+}
+
+/* Imports every triangle primitive of every mesh in the file. Node transforms are ignored. */
+bool meshImportGltf(const char filename[], MeshData *mesh) {
+    size_t size;
+    char *file = readFile(filename, &size);
+    if (file == NULL) return false;
+    memset(mesh, 0, sizeof(*mesh));
+
+    Json json = {};
+    size_t jsonLength = size;
+    GltfBuffer glbChunk = {};
+    json.text = file;
+    if (size >= 20 && memcmp(file, "glTF", 4) == 0) {
+        uint32_t chunkLength;
+        memcpy(&chunkLength, file + 12, sizeof(chunkLength));
+        if (20 + (size_t) chunkLength > size) {
+            fprintf(stderr, "ERROR invalid GLB file: %s\n", filename);
+            free(file);
+            return false;
+        }
+        json.text = file + 20;
+        jsonLength = chunkLength;
+        size_t binOffset = 20 + (size_t) chunkLength;
+        if (binOffset + 8 <= size) {
+            uint32_t binLength;
+            memcpy(&binLength, file + binOffset, sizeof(binLength));
+            if (binOffset + 8 + binLength <= size) {
+                glbChunk.data = (unsigned char *) file + binOffset + 8;
+                glbChunk.size = binLength;
+            }
+        }
+    }
+
+    size_t position = 0;
+    bool success = parseJsonValue(&json, jsonLength, &position, 0) == 0 && json.tokens[0].type == JSON_OBJECT;
+    GltfBuffer *buffers = NULL;
+    uint32_t bufferCount = 0;
+    if (success) {
+        int64_t bufferArray = jsonFind(&json, 0, "buffers");
+        bufferCount = bufferArray >= 0 ? json.tokens[bufferArray].size : 0;
+        buffers = (GltfBuffer *) calloc(bufferCount + 1, sizeof(GltfBuffer));
+        for (uint32_t i = 0; success && i < bufferCount; ++i) {
+            success = loadGltfBuffer(&json, jsonAt(&json, bufferArray, i), filename, &glbChunk, &buffers[i]);
+        }
+    }
+    if (success) {
+        int64_t meshes = jsonFind(&json, 0, "meshes");
+        uint32_t meshCount = meshes >= 0 ? json.tokens[meshes].size : 0;
+        for (uint32_t m = 0; success && m < meshCount; ++m) {
+            int64_t primitives = jsonFind(&json, jsonAt(&json, meshes, m), "primitives");
+            uint32_t primitiveCount = primitives >= 0 ? json.tokens[primitives].size : 0;
+            for (uint32_t p = 0; success && p < primitiveCount; ++p) {
+                success = appendGltfPrimitive(&json, buffers, bufferCount, jsonAt(&json, primitives, p), mesh);
+            }
+        }
+        success = success && mesh->indexCount > 0;
+    }
+    if (!success) {
+        fprintf(stderr, "ERROR invalid or unsupported glTF file: %s\n", filename);
+        meshDestroy(mesh);
+    }
+
+    for (uint32_t i = 0; i < bufferCount; ++i) {
+        free(buffers[i].data);
+    }
+    free(buffers);
+    free(json.tokens);
+    free(file);
+    return success;
+}
@@ -0,0 +1,54 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mesh.h"
+
+/* Offline converter: imports an OBJ or glTF mesh, optimizes it for the post-transform
+ * cache and vertex fetch, builds the LOD chain, quantizes the attributes and writes the
+ * binary mesh file. */
+int main(const int argc, const char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <input.obj|input.gltf|input.glb> <output.vmesh>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    MeshData mesh;
+    if (!meshImport(argv[1], &mesh)) {
+        return EXIT_FAILURE;
+    }
+    uint32_t importedVertexCount = mesh.vertexCount;
+    float acmrBefore = meshComputeAcmr(mesh.indices, mesh.indexCount, mesh.vertexCount, MESH_CACHE_SIZE);
+    size_t bytesBefore = (size_t) mesh.vertexCount * sizeof(MeshVertex) + (size_t) mesh.indexCount * sizeof(uint32_t);
+
+    uint32_t triangleCount = mesh.indexCount / 3;
+    meshOptimizeVertexCache(mesh.indices, mesh.indexCount, mesh.vertexCount);
+    meshBuildLods(&mesh);
+    meshOptimizeVertexFetch(&mesh);
+    float acmrAfter = meshComputeAcmr(mesh.indices, mesh.lods[0].indexCount, mesh.vertexCount, MESH_CACHE_SIZE);
+    size_t vertexBytes = (size_t) mesh.vertexCount * sizeof(PackedVertex);
+    size_t indexSize = meshIndexSize(mesh.vertexCount);
+    size_t bytesAfter = vertexBytes + (size_t) mesh.lods[0].indexCount * indexSize;
+    size_t lodBytes = (size_t) (mesh.indexCount - mesh.lods[0].indexCount) * indexSize;
+    size_t fileBytes = meshFileSize(mesh.vertexCount, mesh.indexCount);
+
+    printf("INFO mesh: %s: %u vertices, %u triangles\n", argv[1], mesh.vertexCount, triangleCount);
+    printf("INFO mesh: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f (FIFO cache of %u)\n",
+           acmrBefore, acmrAfter,
+           acmrBefore * triangleCount / importedVertexCount,
+           acmrAfter * triangleCount / mesh.vertexCount,
+           MESH_CACHE_SIZE);
+    for (uint32_t i = 1; i < mesh.lodCount; ++i) {
+        const MeshLod *lod = &mesh.lods[i];
+        printf("INFO mesh: LOD %u: %u triangles, error %g, ACMR %.3f\n", i, lod->indexCount / 3, lod->error,
+               meshComputeAcmr(mesh.indices + lod->indexOffset, lod->indexCount, mesh.vertexCount, MESH_CACHE_SIZE));
+    }
+    printf("INFO mesh: LOD 0 footprint %zu -> %zu bytes (vertex stride %zu -> %zu, index size %zu -> %zu)\n",
+           bytesBefore, bytesAfter, sizeof(MeshVertex), sizeof(PackedVertex), sizeof(uint32_t), indexSize);
+    printf("INFO mesh: file %zu bytes: %zu header, %zu vertices, %zu LOD 0 indices, %zu indices of %u more LODs, %zu padding\n",
+           fileBytes, sizeof(MeshFileHeader), vertexBytes, bytesAfter - vertexBytes, lodBytes, mesh.lodCount - 1,
+           fileBytes - sizeof(MeshFileHeader) - bytesAfter - lodBytes);
+
+    bool success = writeMeshFile(argv[2], &mesh);
+    meshDestroy(&mesh);
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
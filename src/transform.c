@@ -0,0 +1,401 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "transform.h"
+
+/* SSE and AVX kernels are always compiled on x86 and picked at run time, so a single binary
+ * runs everywhere and the benchmark can compare all levels the CPU supports. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TRANSFORM_X86 1
+#include <immintrin.h>
+#define TARGET_SSE __attribute__((target("sse2")))
+#define TARGET_AVX __attribute__((target("avx")))
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#endif
+
+const char *const transformIsaNames[TRANSFORM_ISA_COUNT] = {
+    "scalar",
+    "SSE",
+    "AVX"
+};
+
+bool createTransformInstances(uint32_t count, TransformInstances *instances) {
+    /* One block, every array padded to 8 floats so that each one starts 32 byte aligned. */
+    size_t stride = ((size_t) count + 7) & ~(size_t) 7;
+    float *block = (float *) aligned_alloc(32, (stride > 0 ? stride : 8) * 8 * sizeof(float));
+    if (block == NULL) {
+        return false;
+    }
+    instances->count = count;
+    instances->positionX = block;
+    instances->positionY = block + stride;
+    instances->positionZ = block + 2 * stride;
+    instances->rotationX = block + 3 * stride;
+    instances->rotationY = block + 4 * stride;
+    instances->rotationZ = block + 5 * stride;
+    instances->rotationW = block + 6 * stride;
+    instances->scale = block + 7 * stride;
+    memset(block, 0, stride * 6 * sizeof(float));
+    for (uint32_t i = 0; i < count; ++i) {
+        instances->rotationW[i] = 1.0f;
+        instances->scale[i] = 1.0f;
+    }
+    return true;
+}
+
+void destroyTransformInstances(TransformInstances *instances) {
+    free(instances->positionX);
+    memset(instances, 0, sizeof(*instances));
+}
+
+bool transformIsaSupported(TransformIsa isa) {
+    switch (isa) {
+    case TRANSFORM_ISA_SCALAR:
+        return true;
+#if defined(TRANSFORM_X86)
+    case TRANSFORM_ISA_SSE:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse2");
+    case TRANSFORM_ISA_AVX:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx");
+#endif
+    default:
+        return false;
+    }
+}
+
+TransformIsa transformBestIsa(void) {
+    TransformIsa best = TRANSFORM_ISA_SCALAR;
+    for (int isa = TRANSFORM_ISA_SCALAR + 1; isa < TRANSFORM_ISA_COUNT; ++isa) {
+        if (transformIsaSupported((TransformIsa) isa)) best = (TransformIsa) isa;
+    }
+    return best;
+}
+
+/* Gribb/Hartmann plane extraction from the column-major view-projection matrix, for a depth
+ * range of 0 to 1. Planes are normalized, a point is inside when dot(n, p) + d >= 0. */
+void transformExtractFrustum(const float viewProjection[16], float frustum[6][4]) {
+    for (uint32_t k = 0; k < 4; ++k) {
+        float row0 = viewProjection[4 * k];
+        float row1 = viewProjection[4 * k + 1];
+        float row2 = viewProjection[4 * k + 2];
+        float row3 = viewProjection[4 * k + 3];
+        frustum[0][k] = row3 + row0;
+        frustum[1][k] = row3 - row0;
+        frustum[2][k] = row3 + row1;
+        frustum[3][k] = row3 - row1;
+        frustum[4][k] = row2;
+        frustum[5][k] = row3 - row2;
+    }
+    for (uint32_t p = 0; p < 6; ++p) {
+        float length = sqrtf(frustum[p][0] * frustum[p][0] + frustum[p][1] * frustum[p][1] + frustum[p][2] * frustum[p][2]);
+        for (uint32_t k = 0; k < 4; ++k) {
+            frustum[p][k] /= length;
+        }
+    }
+}
+
+/* q = q * rotation, renormalized so that the error does not accumulate over many frames. */
+static void animateTransformsScalar(TransformInstances *instances, uint32_t first, uint32_t last, const float rotation[4]) {
+    for (uint32_t i = first; i < last; ++i) {
+        float qx = instances->rotationX[i], qy = instances->rotationY[i];
+        float qz = instances->rotationZ[i], qw = instances->rotationW[i];
+        float x = qw * rotation[0] + qx * rotation[3] + qy * rotation[2] - qz * rotation[1];
+        float y = qw * rotation[1] - qx * rotation[2] + qy * rotation[3] + qz * rotation[0];
+        float z = qw * rotation[2] + qx * rotation[1] - qy * rotation[0] + qz * rotation[3];
+        float w = qw * rotation[3] - qx * rotation[0] - qy * rotation[1] - qz * rotation[2];
+        float inverseLength = 1.0f / sqrtf(x * x + y * y + z * z + w * w);
+        instances->rotationX[i] = x * inverseLength;
+        instances->rotationY[i] = y * inverseLength;
+        instances->rotationZ[i] = z * inverseLength;
+        instances->rotationW[i] = w * inverseLength;
+    }
+}
+
+/* model = translate(position) * rotate(rotation) * scale(scale) * translate(-pivot), the
+ * result is viewProjection * model. The bounding sphere is centered at the position. */
+static uint32_t updateInstanceDataScalar(const TransformInstances *instances, uint32_t first, uint32_t last,
+                                         const TransformBatch *batch, InstanceData *destination, uint32_t *visible,
+                                         uint32_t visibleCount) {
+    const float *vp = batch->viewProjection;
+    for (uint32_t i = first; i < last; ++i) {
+        float px = instances->positionX[i], py = instances->positionY[i], pz = instances->positionZ[i];
+        float s = instances->scale[i];
+        float negativeRadius = -batch->boundingRadius * s;
+        bool inside = true;
+        for (uint32_t p = 0; p < 6; ++p) {
+            const float *plane = batch->frustum[p];
+            inside = inside && plane[0] * px + plane[1] * py + plane[2] * pz + plane[3] >= negativeRadius;
+        }
+        if (!inside) continue;
+
+        float qx = instances->rotationX[i], qy = instances->rotationY[i];
+        float qz = instances->rotationZ[i], qw = instances->rotationW[i];
+        float x2 = qx + qx, y2 = qy + qy, z2 = qz + qz;
+        float xx = qx * x2, yy = qy * y2, zz = qz * z2;
+        float xy = qx * y2, xz = qx * z2, yz = qy * z2;
+        float wx = qw * x2, wy = qw * y2, wz = qw * z2;
+        /* a[column][row] of rotation * scale */
+        float a[3][3] = {
+            {(1.0f - (yy + zz)) * s, (xy + wz) * s, (xz - wy) * s},
+            {(xy - wz) * s, (1.0f - (xx + zz)) * s, (yz + wx) * s},
+            {(xz + wy) * s, (yz - wx) * s, (1.0f - (xx + yy)) * s}
+        };
+        float t[3];
+        for (uint32_t row = 0; row < 3; ++row) {
+            t[row] = (row == 0 ? px : row == 1 ? py : pz)
+                   - (a[0][row] * batch->pivot[0] + a[1][row] * batch->pivot[1] + a[2][row] * batch->pivot[2]);
+        }
+        float *out = destination[visibleCount].modelViewProjection;
+        for (uint32_t column = 0; column < 3; ++column) {
+            for (uint32_t row = 0; row < 4; ++row) {
+                out[4 * column + row] = vp[row] * a[column][0] + vp[4 + row] * a[column][1] + vp[8 + row] * a[column][2];
+            }
+        }
+        for (uint32_t row = 0; row < 4; ++row) {
+            out[12 + row] = vp[row] * t[0] + vp[4 + row] * t[1] + vp[8 + row] * t[2] + vp[12 + row];
+        }
+        if (visible != NULL) visible[visibleCount] = i;
+        visibleCount++;
+    }
+    return visibleCount;
+}
+
+#if defined(TRANSFORM_X86)
+/* Transposes the 16 lane vectors of 4 instances into per-instance matrices and writes the
+ * visible ones with non-temporal stores: the destination is write-combined GPU memory, every
+ * slot is written completely and in order and never read back. */
+TARGET_SSE
+static ALWAYS_INLINE uint32_t storeVisible4(__m128 m[16], int mask, uint32_t index, InstanceData *destination,
+                                            uint32_t *visible, uint32_t visibleCount) {
+    __m128 columns[4][4];
+    for (uint32_t c = 0; c < 4; ++c) {
+        __m128 r0 = m[4 * c], r1 = m[4 * c + 1], r2 = m[4 * c + 2], r3 = m[4 * c + 3];
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        columns[0][c] = r0;
+        columns[1][c] = r1;
+        columns[2][c] = r2;
+        columns[3][c] = r3;
+    }
+    for (uint32_t k = 0; k < 4; ++k) {
+        if (!(mask & (1 << k))) continue;
+        float *out = destination[visibleCount].modelViewProjection;
+        _mm_stream_ps(out, columns[k][0]);
+        _mm_stream_ps(out + 4, columns[k][1]);
+        _mm_stream_ps(out + 8, columns[k][2]);
+        _mm_stream_ps(out + 12, columns[k][3]);
+        if (visible != NULL) visible[visibleCount] = index + k;
+        visibleCount++;
+    }
+    return visibleCount;
+}
+
+TARGET_SSE
+static void animateTransformsSse(TransformInstances *instances, uint32_t count, const float rotation[4]) {
+    __m128 rx = _mm_set1_ps(rotation[0]), ry = _mm_set1_ps(rotation[1]);
+    __m128 rz = _mm_set1_ps(rotation[2]), rw = _mm_set1_ps(rotation[3]);
+    __m128 one = _mm_set1_ps(1.0f);
+    for (uint32_t i = 0; i < count; i += 4) {
+        __m128 qx = _mm_load_ps(&instances->rotationX[i]), qy = _mm_load_ps(&instances->rotationY[i]);
+        __m128 qz = _mm_load_ps(&instances->rotationZ[i]), qw = _mm_load_ps(&instances->rotationW[i]);
+        __m128 x = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(qw, rx), _mm_mul_ps(qx, rw)), _mm_mul_ps(qy, rz)), _mm_mul_ps(qz, ry));
+        __m128 y = _mm_add_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(qw, ry), _mm_mul_ps(qx, rz)), _mm_mul_ps(qy, rw)), _mm_mul_ps(qz, rx));
+        __m128 z = _mm_add_ps(_mm_sub_ps(_mm_add_ps(_mm_mul_ps(qw, rz), _mm_mul_ps(qx, ry)), _mm_mul_ps(qy, rx)), _mm_mul_ps(qz, rw));
+        __m128 w = _mm_sub_ps(_mm_sub_ps(_mm_sub_ps(_mm_mul_ps(qw, rw), _mm_mul_ps(qx, rx)), _mm_mul_ps(qy, ry)), _mm_mul_ps(qz, rz));
+        __m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w)));
+        __m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSquared));
+        _mm_store_ps(&instances->rotationX[i], _mm_mul_ps(x, inverseLength));
+        _mm_store_ps(&instances->rotationY[i], _mm_mul_ps(y, inverseLength));
+        _mm_store_ps(&instances->rotationZ[i], _mm_mul_ps(z, inverseLength));
+        _mm_store_ps(&instances->rotationW[i], _mm_mul_ps(w, inverseLength));
+    }
+}
+
+TARGET_SSE
+static uint32_t updateInstanceDataSse(const TransformInstances *instances, uint32_t count, const TransformBatch *batch,
+                                      InstanceData *destination, uint32_t *visible) {
+    const float *vp = batch->viewProjection;
+    __m128 planes[6][4];
+    for (uint32_t p = 0; p < 6; ++p) {
+        for (uint32_t k = 0; k < 4; ++k) planes[p][k] = _mm_set1_ps(batch->frustum[p][k]);
+    }
+    __m128 negativeRadius = _mm_set1_ps(-batch->boundingRadius);
+    __m128 pivotX = _mm_set1_ps(batch->pivot[0]), pivotY = _mm_set1_ps(batch->pivot[1]), pivotZ = _mm_set1_ps(batch->pivot[2]);
+    __m128 one = _mm_set1_ps(1.0f);
+    uint32_t visibleCount = 0;
+    for (uint32_t i = 0; i < count; i += 4) {
+        __m128 px = _mm_load_ps(&instances->positionX[i]);
+        __m128 py = _mm_load_ps(&instances->positionY[i]);
+        __m128 pz = _mm_load_ps(&instances->positionZ[i]);
+        __m128 s = _mm_load_ps(&instances->scale[i]);
+        __m128 radius = _mm_mul_ps(negativeRadius, s);
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (uint32_t p = 0; p < 6; ++p) {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planes[p][0], px), _mm_mul_ps(planes[p][1], py)),
+                                         _mm_add_ps(_mm_mul_ps(planes[p][2], pz), planes[p][3]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, radius));
+        }
+        int mask = _mm_movemask_ps(inside);
+        if (mask == 0) continue;
+
+        __m128 qx = _mm_load_ps(&instances->rotationX[i]), qy = _mm_load_ps(&instances->rotationY[i]);
+        __m128 qz = _mm_load_ps(&instances->rotationZ[i]), qw = _mm_load_ps(&instances->rotationW[i]);
+        __m128 x2 = _mm_add_ps(qx, qx), y2 = _mm_add_ps(qy, qy), z2 = _mm_add_ps(qz, qz);
+        __m128 xx = _mm_mul_ps(qx, x2), yy = _mm_mul_ps(qy, y2), zz = _mm_mul_ps(qz, z2);
+        __m128 xy = _mm_mul_ps(qx, y2), xz = _mm_mul_ps(qx, z2), yz = _mm_mul_ps(qy, z2);
+        __m128 wx = _mm_mul_ps(qw, x2), wy = _mm_mul_ps(qw, y2), wz = _mm_mul_ps(qw, z2);
+        __m128 a[3][3] = {
+            {_mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), s), _mm_mul_ps(_mm_add_ps(xy, wz), s), _mm_mul_ps(_mm_sub_ps(xz, wy), s)},
+            {_mm_mul_ps(_mm_sub_ps(xy, wz), s), _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), s), _mm_mul_ps(_mm_add_ps(yz, wx), s)},
+            {_mm_mul_ps(_mm_add_ps(xz, wy), s), _mm_mul_ps(_mm_sub_ps(yz, wx), s), _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), s)}
+        };
+        __m128 p[3] = {px, py, pz};
+        __m128 t[3];
+        for (uint32_t row = 0; row < 3; ++row) {
+            __m128 pivot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0][row], pivotX), _mm_mul_ps(a[1][row], pivotY)), _mm_mul_ps(a[2][row], pivotZ));
+            t[row] = _mm_sub_ps(p[row], pivot);
+        }
+        __m128 m[16];
+        for (uint32_t row = 0; row < 4; ++row) {
+            __m128 vp0 = _mm_set1_ps(vp[row]), vp1 = _mm_set1_ps(vp[4 + row]);
+            __m128 vp2 = _mm_set1_ps(vp[8 + row]), vp3 = _mm_set1_ps(vp[12 + row]);
+            for (uint32_t column = 0; column < 3; ++column) {
+                m[4 * column + row] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vp0, a[column][0]), _mm_mul_ps(vp1, a[column][1])),
+                                                 _mm_mul_ps(vp2, a[column][2]));
+            }
+            m[12 + row] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vp0, t[0]), _mm_mul_ps(vp1, t[1])),
+                                                _mm_mul_ps(vp2, t[2])), vp3);
+        }
+        visibleCount = storeVisible4(m, mask, i, destination, visible, visibleCount);
+    }
+    _mm_sfence();
+    return visibleCount;
+}
+
+TARGET_AVX
+static void animateTransformsAvx(TransformInstances *instances, uint32_t count, const float rotation[4]) {
+    __m256 rx = _mm256_set1_ps(rotation[0]), ry = _mm256_set1_ps(rotation[1]);
+    __m256 rz = _mm256_set1_ps(rotation[2]), rw = _mm256_set1_ps(rotation[3]);
+    __m256 one = _mm256_set1_ps(1.0f);
+    for (uint32_t i = 0; i < count; i += 8) {
+        __m256 qx = _mm256_load_ps(&instances->rotationX[i]), qy = _mm256_load_ps(&instances->rotationY[i]);
+        __m256 qz = _mm256_load_ps(&instances->rotationZ[i]), qw = _mm256_load_ps(&instances->rotationW[i]);
+        __m256 x = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(qw, rx), _mm256_mul_ps(qx, rw)), _mm256_mul_ps(qy, rz)), _mm256_mul_ps(qz, ry));
+        __m256 y = _mm256_add_ps(_mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(qw, ry), _mm256_mul_ps(qx, rz)), _mm256_mul_ps(qy, rw)), _mm256_mul_ps(qz, rx));
+        __m256 z = _mm256_add_ps(_mm256_sub_ps(_mm256_add_ps(_mm256_mul_ps(qw, rz), _mm256_mul_ps(qx, ry)), _mm256_mul_ps(qy, rx)), _mm256_mul_ps(qz, rw));
+        __m256 w = _mm256_sub_ps(_mm256_sub_ps(_mm256_sub_ps(_mm256_mul_ps(qw, rw), _mm256_mul_ps(qx, rx)), _mm256_mul_ps(qy, ry)), _mm256_mul_ps(qz, rz));
+        __m256 lengthSquared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_add_ps(_mm256_mul_ps(z, z), _mm256_mul_ps(w, w)));
+        __m256 inverseLength = _mm256_div_ps(one, _mm256_sqrt_ps(lengthSquared));
+        _mm256_store_ps(&instances->rotationX[i], _mm256_mul_ps(x, inverseLength));
+        _mm256_store_ps(&instances->rotationY[i], _mm256_mul_ps(y, inverseLength));
+        _mm256_store_ps(&instances->rotationZ[i], _mm256_mul_ps(z, inverseLength));
+        _mm256_store_ps(&instances->rotationW[i], _mm256_mul_ps(w, inverseLength));
+    }
+}
+
+TARGET_AVX
+static uint32_t updateInstanceDataAvx(const TransformInstances *instances, uint32_t count, const TransformBatch *batch,
+                                      InstanceData *destination, uint32_t *visible) {
+    const float *vp = batch->viewProjection;
+    __m256 planes[6][4];
+    for (uint32_t p = 0; p < 6; ++p) {
+        for (uint32_t k = 0; k < 4; ++k) planes[p][k] = _mm256_set1_ps(batch->frustum[p][k]);
+    }
+    __m256 negativeRadius = _mm256_set1_ps(-batch->boundingRadius);
+    __m256 pivotX = _mm256_set1_ps(batch->pivot[0]), pivotY = _mm256_set1_ps(batch->pivot[1]), pivotZ = _mm256_set1_ps(batch->pivot[2]);
+    __m256 one = _mm256_set1_ps(1.0f);
+    uint32_t visibleCount = 0;
+    for (uint32_t i = 0; i < count; i += 8) {
+        __m256 px = _mm256_load_ps(&instances->positionX[i]);
+        __m256 py = _mm256_load_ps(&instances->positionY[i]);
+        __m256 pz = _mm256_load_ps(&instances->positionZ[i]);
+        __m256 s = _mm256_load_ps(&instances->scale[i]);
+        __m256 radius = _mm256_mul_ps(negativeRadius, s);
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (uint32_t p = 0; p < 6; ++p) {
+            __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(planes[p][0], px), _mm256_mul_ps(planes[p][1], py)),
+                                            _mm256_add_ps(_mm256_mul_ps(planes[p][2], pz), planes[p][3]));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, radius, _CMP_GE_OQ));
+        }
+        int mask = _mm256_movemask_ps(inside);
+        if (mask == 0) continue;
+
+        __m256 qx = _mm256_load_ps(&instances->rotationX[i]), qy = _mm256_load_ps(&instances->rotationY[i]);
+        __m256 qz = _mm256_load_ps(&instances->rotationZ[i]), qw = _mm256_load_ps(&instances->rotationW[i]);
+        __m256 x2 = _mm256_add_ps(qx, qx), y2 = _mm256_add_ps(qy, qy), z2 = _mm256_add_ps(qz, qz);
+        __m256 xx = _mm256_mul_ps(qx, x2), yy = _mm256_mul_ps(qy, y2), zz = _mm256_mul_ps(qz, z2);
+        __m256 xy = _mm256_mul_ps(qx, y2), xz = _mm256_mul_ps(qx, z2), yz = _mm256_mul_ps(qy, z2);
+        __m256 wx = _mm256_mul_ps(qw, x2), wy = _mm256_mul_ps(qw, y2), wz = _mm256_mul_ps(qw, z2);
+        __m256 a[3][3] = {
+            {_mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(yy, zz)), s), _mm256_mul_ps(_mm256_add_ps(xy, wz), s), _mm256_mul_ps(_mm256_sub_ps(xz, wy), s)},
+            {_mm256_mul_ps(_mm256_sub_ps(xy, wz), s), _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(xx, zz)), s), _mm256_mul_ps(_mm256_add_ps(yz, wx), s)},
+            {_mm256_mul_ps(_mm256_add_ps(xz, wy), s), _mm256_mul_ps(_mm256_sub_ps(yz, wx), s), _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(xx, yy)), s)}
+        };
+        __m256 p[3] = {px, py, pz};
+        __m256 t[3];
+        for (uint32_t row = 0; row < 3; ++row) {
+            __m256 pivot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a[0][row], pivotX), _mm256_mul_ps(a[1][row], pivotY)), _mm256_mul_ps(a[2][row], pivotZ));
+            t[row] = _mm256_sub_ps(p[row], pivot);
+        }
+        __m128 low[16], high[16];
+        for (uint32_t row = 0; row < 4; ++row) {
+            __m256 vp0 = _mm256_set1_ps(vp[row]), vp1 = _mm256_set1_ps(vp[4 + row]);
+            __m256 vp2 = _mm256_set1_ps(vp[8 + row]), vp3 = _mm256_set1_ps(vp[12 + row]);
+            for (uint32_t column = 0; column < 4; ++column) {
+                __m256 m;
+                if (column < 3) {
+                    m = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vp0, a[column][0]), _mm256_mul_ps(vp1, a[column][1])),
+                                      _mm256_mul_ps(vp2, a[column][2]));
+                } else {
+                    m = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vp0, t[0]), _mm256_mul_ps(vp1, t[1])),
+                                                    _mm256_mul_ps(vp2, t[2])), vp3);
+                }
+                low[4 * column + row] = _mm256_castps256_ps128(m);
+                high[4 * column + row] = _mm256_extractf128_ps(m, 1);
+            }
+        }
+        if (mask & 0x0f) visibleCount = storeVisible4(low, mask & 0x0f, i, destination, visible, visibleCount);
+        if (mask & 0xf0) visibleCount = storeVisible4(high, mask >> 4, i + 4, destination, visible, visibleCount);
+    }
+    _mm_sfence();
+    return visibleCount;
+}
+#endif
+
+void animateTransforms(TransformInstances *instances, const float rotation[4], TransformIsa isa) {
+    uint32_t first = 0;
+#if defined(TRANSFORM_X86)
+    if (isa == TRANSFORM_ISA_AVX) {
+        first = instances->count & ~7u;
+        animateTransformsAvx(instances, first, rotation);
+    } else if (isa == TRANSFORM_ISA_SSE) {
+        first = instances->count & ~3u;
+        animateTransformsSse(instances, first, rotation);
+    }
+#endif
+    animateTransformsScalar(instances, first, instances->count, rotation);
+}
+
+/* Frustum culls the instances, composes the model-view-projection matrices of the visible
+ * ones and packs them densely into destination, which is meant to be the persistently mapped
+ * instance buffer and must be 16 byte aligned. visible, if not NULL, receives the instance
+ * index of every written slot. Returns the number of visible instances. */
+uint32_t updateInstanceData(const TransformInstances *instances, const TransformBatch *batch, TransformIsa isa,
+                            InstanceData *destination, uint32_t *visible) {
+    assert(((uintptr_t) destination & 15) == 0);
+    uint32_t first = 0;
+    uint32_t visibleCount = 0;
+#if defined(TRANSFORM_X86)
+    if (isa == TRANSFORM_ISA_AVX) {
+        first = instances->count & ~7u;
+        visibleCount = updateInstanceDataAvx(instances, first, batch, destination, visible);
+    } else if (isa == TRANSFORM_ISA_SSE) {
+        first = instances->count & ~3u;
+        visibleCount = updateInstanceDataSse(instances, first, batch, destination, visible);
+    }
+#endif
+    return updateInstanceDataScalar(instances, first, instances->count, batch, destination, visible, visibleCount);
+}
@@ -0,0 +1,55 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Instance transforms as structure of arrays, so that the kernels load 4 (SSE) or 8 (AVX)
+ * instances per register. Rotations are unit quaternions. */
+typedef struct {
+    uint32_t count;
+    float *positionX;
+    float *positionY;
+    float *positionZ;
+    float *rotationX;
+    float *rotationY;
+    float *rotationZ;
+    float *rotationW;
+    float *scale;
+} TransformInstances;
+
+/* Per-frame constants shared by all instances of one mesh. pivot is the object-space point
+ * placed at the instance position and the center of the bounding sphere. */
+typedef struct {
+    float viewProjection[16];
+    float frustum[6][4];
+    float pivot[3];
+    float boundingRadius;
+} TransformBatch;
+
+/* One slot of the instance buffer: the column-major model-view-projection matrix. */
+typedef struct {
+    float modelViewProjection[16];
+} InstanceData;
+
+typedef enum {
+    TRANSFORM_ISA_SCALAR,
+    TRANSFORM_ISA_SSE,
+    TRANSFORM_ISA_AVX,
+    TRANSFORM_ISA_COUNT
+} TransformIsa;
+
+extern const char *const transformIsaNames[TRANSFORM_ISA_COUNT];
+
+bool createTransformInstances(uint32_t count, TransformInstances *instances);
+void destroyTransformInstances(TransformInstances *instances);
+
+bool transformIsaSupported(TransformIsa isa);
+TransformIsa transformBestIsa(void);
+void transformExtractFrustum(const float viewProjection[16], float frustum[6][4]);
+
+void animateTransforms(TransformInstances *instances, const float rotation[4], TransformIsa isa);
+uint32_t updateInstanceData(const TransformInstances *instances, const TransformBatch *batch, TransformIsa isa,
+                            InstanceData *destination, uint32_t *visible);
+
+#endif
@@ -0,0 +1,118 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "transform.h"
+
+#define BENCH_INSTANCES (1u << 20)
+#define BENCH_ITERATIONS 20
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + 1e-9 * time.tv_nsec;
+}
+
+static float randomFloat(float low, float high) {
+    return low + (high - low) * (float) rand() / (float) RAND_MAX;
+}
+
+/* Looks down +z from the origin at a field of instances spread wide enough that most of them
+ * are culled, like in a large open scene. */
+static void createBatch(TransformBatch *batch) {
+    float f = 1.0f / tanf(0.5f);
+    float near = 0.1f, far = 1000.0f;
+    memset(batch->viewProjection, 0, sizeof(batch->viewProjection));
+    batch->viewProjection[0] = f;
+    batch->viewProjection[5] = -f;
+    batch->viewProjection[10] = far / (far - near);
+    batch->viewProjection[11] = 1.0f;
+    batch->viewProjection[14] = -far * near / (far - near);
+    transformExtractFrustum(batch->viewProjection, batch->frustum);
+    batch->pivot[0] = 0.1f;
+    batch->pivot[1] = 0.0f;
+    batch->pivot[2] = -0.2f;
+    batch->boundingRadius = 1.0f;
+}
+
+static void createInstances(TransformInstances *instances) {
+    srand(1);
+    for (uint32_t i = 0; i < instances->count; ++i) {
+        instances->positionX[i] = randomFloat(-800.0f, 800.0f);
+        instances->positionY[i] = randomFloat(-800.0f, 800.0f);
+        instances->positionZ[i] = randomFloat(-100.0f, 900.0f);
+        float q[4] = {randomFloat(-1.0f, 1.0f), randomFloat(-1.0f, 1.0f), randomFloat(-1.0f, 1.0f), randomFloat(-1.0f, 1.0f)};
+        float length = sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+        instances->rotationX[i] = q[0] / length;
+        instances->rotationY[i] = q[1] / length;
+        instances->rotationZ[i] = q[2] / length;
+        instances->rotationW[i] = q[3] / length;
+        instances->scale[i] = randomFloat(0.5f, 2.0f);
+    }
+}
+
+/* Measures animation plus culling, composition and packing per ISA level, and checks every
+ * level against the scalar kernels. */
+int main(void) {
+    TransformInstances instances;
+    TransformBatch batch;
+    if (!createTransformInstances(BENCH_INSTANCES, &instances)) {
+        fprintf(stderr, "ERROR transform: out of memory\n");
+        return EXIT_FAILURE;
+    }
+    createBatch(&batch);
+    /* stands in for the mapped instance buffer */
+    InstanceData *destination = (InstanceData *) aligned_alloc(64, BENCH_INSTANCES * sizeof(InstanceData));
+    InstanceData *reference = (InstanceData *) aligned_alloc(64, BENCH_INSTANCES * sizeof(InstanceData));
+    uint32_t *visible = (uint32_t *) malloc(BENCH_INSTANCES * sizeof(uint32_t));
+    uint32_t *referenceVisible = (uint32_t *) malloc(BENCH_INSTANCES * sizeof(uint32_t));
+    float rotation[4] = {0.0f, sinf(0.005f), 0.0f, cosf(0.005f)};
+
+    createInstances(&instances);
+    uint32_t referenceCount = updateInstanceData(&instances, &batch, TRANSFORM_ISA_SCALAR, reference, referenceVisible);
+    printf("INFO transform: %u instances, %u visible, %d iterations\n", BENCH_INSTANCES, referenceCount, BENCH_ITERATIONS);
+    for (int isa = 0; isa < TRANSFORM_ISA_COUNT; ++isa) {
+        if (!transformIsaSupported((TransformIsa) isa)) {
+            printf("INFO transform: %-6s not supported\n", transformIsaNames[isa]);
+            continue;
+        }
+        uint32_t count = updateInstanceData(&instances, &batch, (TransformIsa) isa, destination, visible);
+        float maxError = 0.0f;
+        bool match = count == referenceCount && memcmp(visible, referenceVisible, count * sizeof(uint32_t)) == 0;
+        for (uint32_t i = 0; match && i < count; ++i) {
+            for (uint32_t k = 0; k < 16; ++k) {
+                float error = fabsf(destination[i].modelViewProjection[k] - reference[i].modelViewProjection[k]);
+                if (error > maxError) maxError = error;
+            }
+        }
+
+        double animateTime = 0.0, updateTime = 0.0;
+        for (int iteration = 0; iteration < BENCH_ITERATIONS; ++iteration) {
+            double start = now();
+            animateTransforms(&instances, rotation, (TransformIsa) isa);
+            double middle = now();
+            updateInstanceData(&instances, &batch, (TransformIsa) isa, destination, visible);
+            double end = now();
+            animateTime += middle - start;
+            updateTime += end - middle;
+        }
+        double processed = (double) BENCH_INSTANCES * BENCH_ITERATIONS;
+        printf("INFO transform: %-6s animate %8.0f instances/ms, cull+compose+pack %8.0f instances/ms, %s (max error %g)\n",
+               transformIsaNames[isa],
+               processed / (1000.0 * animateTime),
+               processed / (1000.0 * updateTime),
+               match ? "matches scalar" : "MISMATCH", maxError);
+        createInstances(&instances);
+    }
+
+    free(referenceVisible);
+    free(visible);
+    free(reference);
+    free(destination);
+    destroyTransformInstances(&instances);
+    return EXIT_SUCCESS;
+}